@@ -0,0 +1,68 @@
+#include <cstdlib>
+#include <new>
+
+#include "allocation_counter.h"
+
+
+using namespace std;
+
+// Replaces the global operators. In a .cxx of its own so the compiler
+// can't pair a caller's new with the free in delete and warn.
+atomic<uint64_t> allocation_count{0};
+
+void* operator new(size_t size) {
+  allocation_count.fetch_add(1, memory_order_relaxed);
+  void* p = malloc(size == 0 ? 1 : size);
+  if(p == nullptr) { throw bad_alloc(); }
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+// Over-aligned types, aligned_alloc wants a multiple of the alignment
+void* operator new(size_t size, align_val_t alignment) {
+  allocation_count.fetch_add(1, memory_order_relaxed);
+  size_t align = size_t(alignment);
+  size_t rounded = size == 0 ? align : (size + align - 1) / align * align;
+  void* p = aligned_alloc(align, rounded);
+  if(p == nullptr) { throw bad_alloc(); }
+  return p;
+}
+
+void* operator new[](size_t size, align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, align_val_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, align_val_t) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t, align_val_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t, align_val_t) noexcept {
+  free(p);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+
+using namespace std;
+
+// Every operator new in the program, from any thread, so a check can show
+// a code path leaves the heap alone. The replacements are in
+// allocation_counter.cxx, linked into major_check only.
+extern atomic<uint64_t> allocation_count;
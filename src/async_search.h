@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "phonetics.h"
+#include "segmenter.h"
+
+
+using namespace std;
+
+struct SearchQuery {
+  uint digit1 = 0;
+  uint digit2 = 0;
+  uint digit3 = 0;
+  PhonemeTripleMode triple_mode;
+  bool strict_mode;
+  uint64_t generation = 0;
+  // Set for numbers longer than three digits, which are split into words
+  string long_number;
+  // Into the runner's mapping profiles, see mapping_profile.h
+  uint profile = 0;
+  // Which dictionary, see locales.h
+  uint locale = 0;
+  // Set for a word or the start of one, looked up for its number
+  string lookup_word;
+};
+
+struct SearchResult {
+  uint64_t generation = 0;
+  uint locale = 0;
+  string pattern;
+  vector<uint> match_indexes;
+  // The rest of match_indexes are near misses, see near_miss.h
+  uint exact_count = 0;
+  // For a long number query, instead of match_indexes
+  string long_number;
+  vector<Segmentation> segmentations;
+  // For a word lookup, match_indexes are the words starting with it (the
+  // word itself first, exact_count 1) and these their numbers
+  string lookup_word;
+  vector<string> lookup_codes;
+};
+
+// Runs one search at a time on a background thread. Submitting a query
+// cancels the one in flight, and only the newest query's result is kept.
+// notify is called on the search thread once a result can be taken, the
+// GUI uses it to Fl::awake itself. Results are swapped rather than copied,
+// so their buffers go round between the search and the taker and get
+// reused.
+class AsyncSearch {
+  public:
+    typedef function<void(const SearchQuery*, SearchResult*, const atomic<bool>*)> SearchFunction;
+
+  private:
+    SearchFunction search;
+    function<void()> notify;
+    thread worker;
+    mutex lock;
+    condition_variable wake;
+    uint64_t generation = 0;
+    bool has_pending = false;
+    bool has_ready = false;
+    bool stopping = false;
+    SearchQuery pending;
+    SearchQuery running; // search thread only
+    SearchResult working; // search thread only
+    SearchResult ready;
+    atomic<bool> cancelled{false};
+
+    void loop() {
+      unique_lock<mutex> guard(lock);
+      while(true) {
+        wake.wait(guard, [&]{ return stopping || has_pending; });
+        if(stopping) { return; }
+        running = pending;
+        has_pending = false;
+        cancelled = false;
+        guard.unlock();
+
+        working.generation = running.generation;
+        search(&running, &working, &cancelled);
+
+        guard.lock();
+        if(running.generation == generation && !cancelled) {
+          swap(ready, working);
+          has_ready = true;
+          guard.unlock();
+          notify();
+          guard.lock();
+        }
+      }
+    }
+
+  public:
+    AsyncSearch(SearchFunction search, function<void()> notify) {
+      this->search = search;
+      this->notify = notify;
+      worker = thread(&AsyncSearch::loop, this);
+    }
+
+    ~AsyncSearch() {
+      {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+        cancelled = true;
+      }
+      wake.notify_all();
+      worker.join();
+    }
+
+    uint64_t submit(SearchQuery query) {
+      lock_guard<mutex> guard(lock);
+      query.generation = ++generation;
+      pending = query;
+      has_pending = true;
+      has_ready = false;
+      cancelled = true;
+      wake.notify_all();
+      return query.generation;
+    }
+
+    // Drops the query in flight without starting another
+    void cancel() {
+      lock_guard<mutex> guard(lock);
+      generation++;
+      has_pending = false;
+      has_ready = false;
+      cancelled = true;
+    }
+
+    // The newest query's result, if it has finished and not been taken.
+    // out's old contents are kept for reuse.
+    bool take_result(SearchResult* out) {
+      lock_guard<mutex> guard(lock);
+      if(!has_ready || ready.generation != generation) { return false; }
+      swap(*out, ready);
+      has_ready = false;
+      return true;
+    }
+};
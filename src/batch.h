@@ -0,0 +1,278 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "builtin_dictionary.h"
+#include "dictionary_cache.h"
+#include "mapping_profile.h"
+#include "phoneme_matcher.h"
+#include "phonetics.h"
+#include "reverse_index.h"
+#include "segmenter.h"
+#include "word_index.h"
+#include "worker_pool.h"
+
+
+using namespace std;
+
+enum BatchFormat { CSV_FORMAT, JSONL_FORMAT };
+
+struct BatchOptions {
+  BatchFormat format = CSV_FORMAT;
+  bool strict_mode = false;
+  string output_file; // empty for stdout
+  string dict_file;   // empty for the built-in dictionary
+  uint num_threads = 0;
+  // Set to split this long number into words instead of the peg table
+  string long_number;
+  // Set to list the numbers of words starting with lookup_prefix
+  bool lookup = false;
+  string lookup_prefix;
+  // Digit mappings other than the built-in ones
+  const MappingProfile* profile = nullptr;
+};
+
+void append_csv_field(string* out, string_view field) {
+  out->push_back('"');
+  for(char c : field) {
+    if(c == '"') { out->push_back('"'); }
+    out->push_back(c);
+  }
+  out->push_back('"');
+}
+
+void append_json_string(string* out, string_view s) {
+  out->push_back('"');
+  for(char c : s) {
+    switch(c) {
+      case '"': out->append("\\\""); break;
+      case '\\': out->append("\\\\"); break;
+      case '\n': out->append("\\n"); break;
+      case '\t': out->append("\\t"); break;
+      default:
+        if((unsigned char)c < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out->append(escaped);
+        } else {
+          out->push_back(c);
+        }
+    }
+  }
+  out->push_back('"');
+}
+
+// One row of the peg table: a number in one triple mode and its words
+void append_batch_row(string* out, const BatchOptions* options, uint code, PhonemeTripleMode mode,
+                      const string* pattern, WordBucket bucket, const WordContainer* word_container) {
+  char number[4];
+  snprintf(number, sizeof(number), "%03u", code);
+  const char* mode_name = mode == CCC ? "CCC" : "CVC";
+  if(options->format == CSV_FORMAT) {
+    out->append(number).append(",").append(mode_name).append(",");
+    append_csv_field(out, *pattern);
+    out->append(",").append(to_string(bucket.size())).append(",");
+    string words;
+    for(uint i : bucket) {
+      if(!words.empty()) { words.push_back(' '); }
+      words.append(word_container->words[i].word);
+    }
+    append_csv_field(out, words);
+  } else {
+    out->append("{\"number\":\"").append(number).append("\",\"mode\":\"").append(mode_name)
+        .append("\",\"strict\":").append(options->strict_mode ? "true" : "false").append(",\"pattern\":");
+    append_json_string(out, *pattern);
+    out->append(",\"words\":[");
+    for(const uint* i=bucket.begin(); i<bucket.end(); i++) {
+      if(i != bucket.begin()) { out->push_back(','); }
+      append_json_string(out, word_container->words[*i].word);
+    }
+    out->append("]}");
+  }
+  out->push_back('\n');
+}
+
+bool load_batch_dictionary(const BatchOptions* options, WordContainer* word_container, PhonemeMatcher* matcher) {
+  if(options->dict_file.empty()) {
+    load_builtin_dictionary(word_container, matcher);
+    return true;
+  }
+  bool from_cache = false;
+  return load_dictionary(options->dict_file, word_container, matcher, &from_cache);
+}
+
+// stdout unless an output file was given, nullptr if it can't be opened
+FILE* open_batch_output(const BatchOptions* options) {
+  if(options->output_file.empty()) { return stdout; }
+  FILE* out = fopen(options->output_file.c_str(), "w");
+  if(out == nullptr) {
+    fprintf(stderr, "Could not open %s\n", options->output_file.c_str());
+  }
+  return out;
+}
+
+bool close_batch_output(FILE* out) {
+  bool ok = ferror(out) == 0;
+  if(out != stdout) {
+    ok = fclose(out) == 0 && ok;
+  } else {
+    fflush(out);
+  }
+  return ok;
+}
+
+// Every split of options->long_number into words, one row per run of
+// digits with all the words that fit it
+int run_split(const BatchOptions* options) {
+  PhonemePatternSettings settings;
+  if(options->profile != nullptr) { apply_profile(options->profile, &settings); }
+  WordContainer word_container;
+  PhonemeMatcher matcher(&settings);
+  if(!load_batch_dictionary(options, &word_container, &matcher)) { return 1; }
+  auto start = chrono::steady_clock::now();
+  DigitTrie trie;
+  trie.build(&settings, &word_container.words);
+  double build_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  start = chrono::steady_clock::now();
+  NumberSegmenter segmenter(&trie);
+  vector<Segmentation> segmentations;
+  segmenter.segment(options->long_number, 50, 2, &segmentations);
+  double split_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+  FILE* out = open_batch_output(options);
+  if(out == nullptr) { return 1; }
+  string text;
+  if(options->format == CSV_FORMAT) {
+    text.append("split,digits,count,words\n");
+  }
+  for(uint i=0; i<segmentations.size(); i++) {
+    if(options->format == JSONL_FORMAT) {
+      text.append("{\"split\":").append(to_string(i+1)).append(",\"segments\":[");
+    }
+    for(const CodeSegment& segment : segmentations[i]) {
+      string digits = options->long_number.substr(segment.begin, segment.length);
+      if(options->format == CSV_FORMAT) {
+        text.append(to_string(i+1)).append(",").append(digits).append(",")
+            .append(to_string(segment.words.size())).append(",");
+        string words;
+        for(uint w : segment.words) {
+          if(!words.empty()) { words.push_back(' '); }
+          words.append(word_container.words[w].word);
+        }
+        append_csv_field(&text, words);
+        text.push_back('\n');
+      } else {
+        if(&segment != &segmentations[i].front()) { text.push_back(','); }
+        text.append("{\"digits\":\"").append(digits).append("\",\"words\":[");
+        for(const uint* w=segment.words.begin(); w<segment.words.end(); w++) {
+          if(w != segment.words.begin()) { text.push_back(','); }
+          append_json_string(&text, word_container.words[*w].word);
+        }
+        text.append("]}");
+      }
+    }
+    if(options->format == JSONL_FORMAT) {
+      text.append("]}\n");
+    }
+  }
+  fwrite(text.data(), 1, text.size(), out);
+  bool ok = close_batch_output(out);
+  fprintf(stderr, "%zu splits of %zu digits in %.2fms (%u of %zu words coded in %.1fms)\n",
+          segmentations.size(), options->long_number.size(), split_ms, trie.size(),
+          word_container.words.size(), build_ms);
+  return ok ? 0 : 1;
+}
+
+// Words starting with options->lookup_prefix and their full codes, every
+// word for an empty prefix
+int run_lookup(const BatchOptions* options) {
+  PhonemePatternSettings settings;
+  if(options->profile != nullptr) { apply_profile(options->profile, &settings); }
+  WordContainer word_container;
+  PhonemeMatcher matcher(&settings);
+  if(!load_batch_dictionary(options, &word_container, &matcher)) { return 1; }
+  auto start = chrono::steady_clock::now();
+  ReverseIndex reverse_index;
+  reverse_index.build(&settings, &word_container);
+  double build_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  start = chrono::steady_clock::now();
+  vector<uint> found;
+  reverse_index.find_prefix(options->lookup_prefix, word_container.words.size(), &found);
+  double lookup_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+  FILE* out = open_batch_output(options);
+  if(out == nullptr) { return 1; }
+  string text;
+  if(options->format == CSV_FORMAT) {
+    text.append("word,number\n");
+  }
+  for(uint i : found) {
+    if(options->format == CSV_FORMAT) {
+      append_csv_field(&text, word_container.words[i].word);
+      text.append(",").append(reverse_index.code(i)).push_back('\n');
+    } else {
+      text.append("{\"word\":");
+      append_json_string(&text, word_container.words[i].word);
+      text.append(",\"number\":\"").append(reverse_index.code(i)).append("\"}\n");
+    }
+  }
+  fwrite(text.data(), 1, text.size(), out);
+  bool ok = close_batch_output(out);
+  fprintf(stderr, "%zu words in %.3fms (index built in %.1fms)\n", found.size(), lookup_ms, build_ms);
+  return ok ? 0 : 1;
+}
+
+// Peg table for every number 000-999 in both CCC and CVC, without a window.
+// Rows are formatted in parallel blocks and written in order.
+int run_batch(const BatchOptions* options) {
+  if(!options->long_number.empty()) { return run_split(options); }
+  if(options->lookup) { return run_lookup(options); }
+  auto start = chrono::steady_clock::now();
+  PhonemePatternSettings settings;
+  if(options->profile != nullptr) { apply_profile(options->profile, &settings); }
+  WordContainer word_container;
+  PhonemeMatcher matcher(&settings);
+  WordIndex word_index(&settings);
+  if(!load_batch_dictionary(options, &word_container, &matcher)) { return 1; }
+  if(options->dict_file.empty()) {
+    load_builtin_index(&word_index, &settings, &word_container.words);
+  } else {
+    word_index.build(&word_container.words);
+  }
+
+  FILE* out = open_batch_output(options);
+  if(out == nullptr) { return 1; }
+  if(options->format == CSV_FORMAT) {
+    fputs("number,mode,pattern,count,words\n", out);
+  }
+
+  const uint codes_per_block = 50;
+  const uint num_blocks = NUM_CODES / codes_per_block;
+  vector<string> blocks(2*num_blocks);
+  WorkerPool pool(options->num_threads);
+  pool.run(blocks.size(), [&](uint block) {
+    // Each block has its own settings, the compiler reads them
+    PhonemePatternSettings block_settings = settings;
+    block_settings.triple_mode = block < num_blocks ? CCC : CVC;
+    block_settings.strict_mode = options->strict_mode;
+    DigitPatternCompiler compiler(&block_settings);
+    uint first_code = (block % num_blocks) * codes_per_block;
+    for(uint code=first_code; code<first_code+codes_per_block; code++) {
+      string pattern = compiler.compile_pattern(code/100, code/10%10, code%10);
+      WordBucket bucket = word_index.get_bucket(block_settings.triple_mode, options->strict_mode, code);
+      append_batch_row(&blocks[block], options, code, block_settings.triple_mode, &pattern, bucket,
+                       &word_container);
+    }
+  });
+  for(const string& block : blocks) {
+    fwrite(block.data(), 1, block.size(), out);
+  }
+
+  bool ok = close_batch_output(out);
+  fprintf(stderr, "Wrote %u rows in %.1fms\n", 2*NUM_CODES,
+          chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "english_dictionary.h" // generated by make_dictionary at build time
+#include "phoneme_matcher.h"
+#include "phonetics.h"
+#include "word_index.h"
+
+
+using namespace std;
+
+// Points word_container and matcher at the en_UK tables compiled into the
+// binary. Nothing is parsed or copied, only the word views are built.
+void load_builtin_dictionary(WordContainer* word_container, PhonemeMatcher* matcher) {
+  word_container->attach(compiled_dictionary::arena, compiled_dictionary::word_offsets,
+                         compiled_dictionary::num_words);
+  vector<string> symbols(compiled_dictionary::symbols,
+                         compiled_dictionary::symbols + compiled_dictionary::num_symbols);
+  matcher->attach(nullptr, &symbols, compiled_dictionary::tokens, compiled_dictionary::token_offsets,
+                  compiled_dictionary::num_words);
+}
+
+// The compiled buckets when they were made with the same settings,
+// otherwise builds the index from the words.
+void load_builtin_index(WordIndex* word_index, PhonemePatternSettings* settings,
+                        const vector<DictionaryWord>* words) {
+  if(settings_fingerprint(settings) == compiled_dictionary::settings_fingerprint) {
+    word_index->attach(compiled_dictionary::bucket_words, compiled_dictionary::bucket_offsets);
+  } else {
+    word_index->build(words);
+  }
+}
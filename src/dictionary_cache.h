@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "phoneme_matcher.h"
+#include "phonetics.h"
+
+
+using namespace std;
+
+// Binary cache of a parsed and tokenized dictionary, written next to the
+// source as "<file>.cache" and mapped straight back in on later launches.
+// Bump the version whenever the layout or the tokenizer changes.
+const char DICTIONARY_CACHE_MAGIC[8] = {'M', 'A', 'J', 'O', 'R', 'D', 'I', 'C'};
+const uint32_t DICTIONARY_CACHE_VERSION = 2;
+
+struct DictionaryCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_words;
+  // The source file this was built from, a mismatch means rebuild
+  uint64_t source_size;
+  int64_t source_mtime_ns;
+  // Sections, byte offsets from the start of the file
+  uint64_t arena_offset;          // NUL-terminated words and IPA
+  uint64_t arena_size;
+  uint64_t words_offset;          // num_words CachedWords
+  uint64_t tokens_offset;         // PhonemeIds
+  uint64_t num_tokens;
+  uint64_t token_offsets_offset;  // num_words+1 uint32s
+  uint64_t symbols_offset;        // NUL-terminated symbols 1..num_symbols-1
+  uint64_t symbols_size;
+  uint32_t num_symbols;
+  uint32_t reserved;
+};
+
+struct CachedWord {
+  uint32_t word;
+  uint32_t word_size;
+  uint32_t ipa;
+  uint32_t ipa_size;
+};
+
+string dictionary_cache_name(const string& file_name) {
+  return file_name + ".cache";
+}
+
+// Pads out to 8 bytes so every section is aligned when mapped
+void write_section(FILE* out, const void* data, size_t size, uint64_t* offset) {
+  static const char zeros[8] = {0};
+  long position = ftell(out);
+  if(position % 8 != 0) {
+    fwrite(zeros, 1, 8 - position % 8, out);
+  }
+  *offset = ftell(out);
+  if(size > 0) {
+    fwrite(data, 1, size, out);
+  }
+}
+
+// Written to a temporary name and renamed, so a reader never maps half a cache
+bool write_dictionary_cache(const string& cache_name, const MappedFile* source,
+                            const WordContainer* word_container, const PhonemeMatcher* matcher) {
+  string temp_name = cache_name + ".tmp";
+  FILE* out = fopen(temp_name.c_str(), "wb");
+  if(out == nullptr) { return false; }
+
+  DictionaryCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DICTIONARY_CACHE_MAGIC, sizeof(header.magic));
+  header.version = DICTIONARY_CACHE_VERSION;
+  header.num_words = word_container->words.size();
+  header.source_size = source->size;
+  header.source_mtime_ns = source->mtime_ns;
+  fwrite(&header, sizeof(header), 1, out);
+
+  const char* arena = word_container->arena.data();
+  vector<CachedWord> words;
+  words.reserve(word_container->words.size());
+  for(const DictionaryWord& word : word_container->words) {
+    words.push_back(CachedWord{
+      uint32_t(word.word.data() - arena), uint32_t(word.word.size()),
+      uint32_t(word.ipa.data() - arena), uint32_t(word.ipa.size())});
+  }
+  string symbols;
+  for(uint i=1; i<matcher->symbols->symbols.size(); i++) {
+    symbols += matcher->symbols->symbols[i];
+    symbols.push_back('\0');
+  }
+  uint num_tokens = matcher->offset_data[matcher->num_words];
+
+  header.arena_size = word_container->arena.size();
+  header.num_tokens = num_tokens;
+  header.symbols_size = symbols.size();
+  header.num_symbols = matcher->symbols->symbols.size();
+  write_section(out, arena, header.arena_size, &header.arena_offset);
+  write_section(out, words.data(), words.size()*sizeof(CachedWord), &header.words_offset);
+  write_section(out, matcher->token_data, num_tokens*sizeof(PhonemeId), &header.tokens_offset);
+  write_section(out, matcher->offset_data, (matcher->num_words+1)*sizeof(uint), &header.token_offsets_offset);
+  write_section(out, symbols.data(), symbols.size(), &header.symbols_offset);
+
+  fseek(out, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, out);
+  bool ok = ferror(out) == 0;
+  ok = fclose(out) == 0 && ok;
+  if(!ok || rename(temp_name.c_str(), cache_name.c_str()) != 0) {
+    remove(temp_name.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool section_fits(const MappedFile* file, uint64_t offset, uint64_t size) {
+  return offset <= file->size && size <= file->size - offset && offset % 8 == 0;
+}
+
+// Points word_container and matcher straight into the mapped cache
+bool attach_dictionary_cache(shared_ptr<MappedFile> cache, const MappedFile* source,
+                             WordContainer* word_container, PhonemeMatcher* matcher) {
+  if(cache->size < sizeof(DictionaryCacheHeader)) { return false; }
+  const DictionaryCacheHeader* header = (const DictionaryCacheHeader*)cache->data;
+  if(memcmp(header->magic, DICTIONARY_CACHE_MAGIC, sizeof(header->magic)) != 0
+     || header->version != DICTIONARY_CACHE_VERSION
+     || header->source_size != source->size
+     || header->source_mtime_ns != source->mtime_ns) {
+    return false;
+  }
+  uint64_t num_words = header->num_words;
+  if(!section_fits(cache.get(), header->arena_offset, header->arena_size)
+     || !section_fits(cache.get(), header->words_offset, num_words*sizeof(CachedWord))
+     || !section_fits(cache.get(), header->tokens_offset, header->num_tokens*sizeof(PhonemeId))
+     || !section_fits(cache.get(), header->token_offsets_offset, (num_words+1)*sizeof(uint))
+     || !section_fits(cache.get(), header->symbols_offset, header->symbols_size)) {
+    return false;
+  }
+
+  const char* arena = cache->data + header->arena_offset;
+  const CachedWord* words = (const CachedWord*)(cache->data + header->words_offset);
+  vector<DictionaryWord> views;
+  views.reserve(num_words);
+  for(uint i=0; i<num_words; i++) {
+    const CachedWord* word = &words[i];
+    if(uint64_t(word->word) + word->word_size >= header->arena_size
+       || uint64_t(word->ipa) + word->ipa_size >= header->arena_size) {
+      return false;
+    }
+    views.push_back(DictionaryWord{
+      string_view(arena + word->word, word->word_size),
+      string_view(arena + word->ipa, word->ipa_size)});
+  }
+
+  vector<string> symbols{""};
+  const char* symbol = cache->data + header->symbols_offset;
+  const char* symbols_end = symbol + header->symbols_size;
+  while(symbol < symbols_end) {
+    size_t size = strnlen(symbol, symbols_end - symbol);
+    symbols.push_back(string(symbol, size));
+    symbol += size + 1;
+  }
+  if(symbols.size() != header->num_symbols) { return false; }
+
+  // Matching trusts these, so a damaged cache is parsed again instead
+  const uint* token_offsets = (const uint*)(cache->data + header->token_offsets_offset);
+  const PhonemeId* tokens = (const PhonemeId*)(cache->data + header->tokens_offset);
+  if(token_offsets[num_words] != header->num_tokens) { return false; }
+  for(uint i=0; i<num_words; i++) {
+    if(token_offsets[i] > token_offsets[i+1]) { return false; }
+    for(uint t=token_offsets[i]; t<token_offsets[i+1]; t++) {
+      if(tokens[t] >= header->num_symbols) { return false; }
+    }
+  }
+
+  word_container->arena.clear();
+  word_container->mapping = cache;
+  word_container->words.swap(views);
+  matcher->attach(cache, &symbols, tokens, token_offsets, num_words);
+  return true;
+}
+
+// Loads an external IPA dictionary ("word\t/ipa/" lines), from its cache
+// when that is current and otherwise by parsing the mapped text and then
+// writing the cache for next time. Returns false if the file can't be read.
+// chunk_loaded reports parsing progress, see WordContainer::load.
+bool load_dictionary(const string& file_name, WordContainer* word_container, PhonemeMatcher* matcher,
+                     bool* from_cache, function<void(uint, float)> chunk_loaded = nullptr) {
+  MappedFile source;
+  if(!source.open(file_name)) {
+    cout << "Could not open file " << file_name << endl;
+    return false;
+  }
+  string cache_name = dictionary_cache_name(file_name);
+  shared_ptr<MappedFile> cache = make_shared<MappedFile>();
+  if(cache->open(cache_name) && attach_dictionary_cache(cache, &source, word_container, matcher)) {
+    *from_cache = true;
+    return true;
+  }
+
+  *from_cache = false;
+  word_container->load(source.data, source.size, chunk_loaded);
+  matcher->tokenize(&word_container->words);
+  if(!write_dictionary_cache(cache_name, &source, word_container, matcher)) {
+    cout << "Could not write dictionary cache " << cache_name << endl;
+  }
+  return true;
+}
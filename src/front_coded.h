@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+using namespace std;
+
+// Words per block, the most a random access decodes
+const uint FRONT_CODED_BLOCK = 16;
+
+// Spellings and IPA front coded in blocks of FRONT_CODED_BLOCK words. Each
+// string is stored as how many leading bytes it shares with the one before
+// (the word before's spelling, or its IPA), how many follow and then those
+// bytes, the counts as varints. Inflected runs like abandon, abandoned,
+// abandoning mostly come down to their endings. The first word of a block
+// shares nothing, so any word decodes from its block's start.
+class FrontCodedWords {
+  private:
+    string last_word;
+    string last_ipa;
+
+    void put_varint(uint value) {
+      while(value >= 0x80) {
+        data.push_back(char((value & 0x7f) | 0x80));
+        value >>= 7;
+      }
+      data.push_back(char(value));
+    }
+
+    void put(string_view s, string* last) {
+      uint shared = 0;
+      if(num_words % FRONT_CODED_BLOCK != 0) {
+        uint most = min(s.size(), last->size());
+        while(shared < most && s[shared] == (*last)[shared]) { shared++; }
+      }
+      put_varint(shared);
+      put_varint(s.size() - shared);
+      data.append(s.data() + shared, s.size() - shared);
+      last->assign(s);
+    }
+
+  public:
+    string data;
+    // Where each block starts in data
+    vector<uint> block_offsets;
+    uint num_words = 0;
+
+    void clear() {
+      data.clear();
+      block_offsets.clear();
+      num_words = 0;
+    }
+
+    // Words are appended in order, shrink() once the last is in
+    void add(string_view word, string_view ipa) {
+      if(num_words % FRONT_CODED_BLOCK == 0) { block_offsets.push_back(data.size()); }
+      put(word, &last_word);
+      put(ipa, &last_ipa);
+      num_words++;
+    }
+
+    void shrink() {
+      data.shrink_to_fit();
+      block_offsets.shrink_to_fit();
+      last_word = string();
+      last_ipa = string();
+    }
+
+    uint size() const {
+      return num_words;
+    }
+
+    size_t memory_bytes() const {
+      return data.capacity() + block_offsets.capacity()*sizeof(uint);
+    }
+};
+
+// Decodes words out of a FrontCodedWords into its own buffers, which stay
+// valid (and NUL terminated) until the next get. Reading words in
+// ascending order decodes each once, anything else starts from the
+// block's first word. One per thread.
+class FrontCodedReader {
+  private:
+    const FrontCodedWords* words = nullptr;
+    const char* next = nullptr;
+    // Index of the word at next
+    uint position = 0;
+
+    uint get_varint() {
+      uint value = 0;
+      for(uint shift=0;; shift+=7) {
+        uint8_t byte = *next++;
+        value |= uint(byte & 0x7f) << shift;
+        if(byte < 0x80) { return value; }
+      }
+    }
+
+    void decode(string* s) {
+      uint shared = get_varint();
+      uint size = get_varint();
+      s->resize(shared);
+      s->append(next, size);
+      next += size;
+    }
+
+  public:
+    string word;
+    string ipa;
+
+    FrontCodedReader() {
+      word.reserve(64);
+      ipa.reserve(64);
+    }
+
+    void get(const FrontCodedWords* words, uint i) {
+      bool same = words == this->words && next != nullptr;
+      if(same && i + 1 == position) { return; }
+      uint block = i / FRONT_CODED_BLOCK;
+      if(!same || i < position || block != position / FRONT_CODED_BLOCK) {
+        this->words = words;
+        next = words->data.data() + words->block_offsets[block];
+        position = block * FRONT_CODED_BLOCK;
+      }
+      while(position <= i) {
+        decode(&word);
+        decode(&ipa);
+        position++;
+      }
+    }
+};
@@ -0,0 +1,405 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "builtin_dictionary.h"
+#include "dictionary_cache.h"
+#include "mapped_file.h"
+#include "mapping_profile.h"
+#include "phoneme_matcher.h"
+#include "phonetics.h"
+#include "prefilter.h"
+#include "query_cache.h"
+#include "query_runner.h"
+#include "ranker.h"
+#include "trace.h"
+#include "word_index.h"
+#include "worker_pool.h"
+
+
+using namespace std;
+
+const size_t ARENA_CHUNK_BYTES = 1 << 20;
+
+// Spellings and IPA of the dictionaries loaded after the first, NUL
+// terminated like WordContainer's arena. Chunks never move, so views into
+// them stay valid as more dictionaries are added.
+class SharedArena {
+  private:
+    vector<unique_ptr<char[]>> chunks;
+    size_t used = ARENA_CHUNK_BYTES;
+
+  public:
+    // Allocated for chunks, and used by strings
+    size_t bytes = 0;
+    size_t stored = 0;
+
+    string_view add(string_view s) {
+      if(used + s.size() + 1 > ARENA_CHUNK_BYTES) {
+        size_t size = max(ARENA_CHUNK_BYTES, s.size() + 1);
+        chunks.emplace_back(new char[size]);
+        bytes += size;
+        used = 0;
+      }
+      char* copy = chunks.back().get() + used;
+      memcpy(copy, s.data(), s.size());
+      copy[s.size()] = '\0';
+      used += s.size() + 1;
+      stored += s.size() + 1;
+      return string_view(copy, s.size());
+    }
+};
+
+struct LocaleOptions {
+  MatchEngine engine = INDEX_ENGINE;
+  WorkerPool* pool = nullptr;
+  size_t query_cache_bytes = 16 << 20;
+  string freq_file;
+  uint near_misses = 1;
+  const vector<MappingProfile>* profiles = nullptr;
+  // Keep the words front coded once everything is built from them (see
+  // front_coded.h), not shared between dictionaries and without the
+  // prefilter, whose slots would hold most of the IPA again
+  bool compact_words = false;
+};
+
+// One dictionary and everything searched with it
+class Locale {
+  public:
+    string name;
+    string dict_file; // empty for the built-in en_UK
+    // Set by whichever thread loaded it, once everything below is built.
+    // After that the words are read-only and the rest is the search thread's.
+    atomic<bool> loaded{false};
+    bool loading = false; // LocaleSet's lock
+    bool failed = false;
+    // Before loaded, the first words_ready of word_container.words may be
+    // read, e.g. to show them, see WordContainer::load
+    atomic<uint> words_ready{0};
+    // Share of the file parsed, 0-1
+    atomic<float> progress{0};
+    double load_ms = 0;
+    // Bytes of strings this dictionary added to the SharedArena, and of
+    // those it found already resident
+    size_t string_bytes = 0;
+    size_t shared_string_bytes = 0;
+    PhonemePatternSettings settings;
+    WordContainer word_container;
+    PhonemeMatcher matcher;
+    WordIndex word_index;
+    QueryCache query_cache;
+    BytePrefilter prefilter;
+    WordRanker ranker;
+    QueryRunner* runner = nullptr;
+
+    Locale(string name, string dict_file, PhonemeSymbols* shared_symbols, size_t query_cache_bytes)
+        : matcher(&settings, shared_symbols), word_index(&settings), query_cache(query_cache_bytes) {
+      this->name = name;
+      this->dict_file = dict_file;
+    }
+
+    ~Locale() {
+      delete runner;
+    }
+
+    // Heap and mapped bytes held for this dictionary alone, not counting
+    // tables compiled into the binary or what a first query builds later
+    size_t memory_bytes() const {
+      size_t bytes = word_container.words.capacity()*sizeof(DictionaryWord) + word_container.compact.memory_bytes();
+      bytes += string_bytes + word_container.arena.capacity();
+      bytes += word_container.mapping ? word_container.mapping->size : 0;
+      bytes += matcher.tokens.capacity()*sizeof(PhonemeId) + matcher.offsets.capacity()*sizeof(uint);
+      bytes += word_index.bucket_words.capacity()*sizeof(uint) + word_index.bucket_offsets.capacity()*sizeof(uint);
+      return bytes;
+    }
+};
+
+// Several dictionaries resident side by side. The first is loaded before
+// the rest and owns the interned phoneme table, they intern into it, so tokens
+// mean the same in all of them. Their words go into one SharedArena, reusing
+// any spelling or IPA already resident. Dictionaries are loaded on a
+// background thread when first asked for, and notify is called there as
+// their words arrive and when one is ready.
+class LocaleSet {
+  private:
+    LocaleOptions options;
+    SharedArena arena;
+    // Held while tokenizing into, or compiling from, the shared table
+    mutex symbols_lock;
+    function<void(uint)> notify;
+    thread loader;
+    mutex lock;
+    condition_variable wake;
+    vector<pair<uint, uint>> pending; // (locale, profile)
+    // The search thread's, for queries before a locale has loaded
+    PhonemePatternSettings partial_settings;
+    DigitPatternCompiler partial_compiler;
+    bool stopping = false;
+
+    // Parsed by WordContainer, then each string swapped for a resident
+    // copy if there is one or copied into the arena
+    bool load_words(uint index) {
+      Locale* locale = locales[index];
+      MappedFile file;
+      if(!file.open(locale->dict_file)) {
+        cout << "Could not open file " << locale->dict_file << endl;
+        return false;
+      }
+      if(options.compact_words) {
+        locale->word_container.load(file.data, file.size, [&](uint ready, float progress) {
+          publish(index, ready, progress);
+        });
+        file.close();
+        lock_guard<mutex> guard(symbols_lock);
+        locale->matcher.tokenize(&locale->word_container.words);
+        return true;
+      }
+      WordContainer parsed;
+      parsed.load(file.data, file.size, [&](uint, float progress) {
+        publish(index, 0, progress);
+      });
+      file.close();
+
+      unordered_set<string_view> resident;
+      for(const Locale* other : locales) {
+        if(other == locale || !other->loaded) { continue; }
+        for(const DictionaryWord& word : other->word_container.words) {
+          resident.insert(word.word);
+          resident.insert(word.ipa);
+        }
+      }
+      size_t before = arena.stored;
+      vector<DictionaryWord> words;
+      words.reserve(parsed.words.size());
+      for(const DictionaryWord& word : parsed.words) {
+        string_view strings[2] = {word.word, word.ipa};
+        for(string_view& s : strings) {
+          auto found = resident.find(s);
+          if(found != resident.end()) {
+            locale->shared_string_bytes += s.size() + 1;
+            s = *found;
+          } else {
+            s = arena.add(s);
+            resident.insert(s);
+          }
+        }
+        words.push_back(DictionaryWord{strings[0], strings[1]});
+      }
+      locale->string_bytes = arena.stored - before;
+      locale->word_container.words.swap(words);
+      publish(index, locale->word_container.words.size(), 1);
+      lock_guard<mutex> guard(symbols_lock);
+      locale->matcher.tokenize(&locale->word_container.words);
+      return true;
+    }
+
+    // Built-in, or from the file's cache when it's current
+    bool load_first_words(uint index) {
+      Locale* locale = locales[index];
+      auto start = chrono::steady_clock::now();
+      bool ok = true;
+      bool from_cache = false;
+      if(locale->dict_file.empty()) {
+        load_builtin_dictionary(&locale->word_container, &locale->matcher);
+        publish(index, locale->word_container.words.size(), 1);
+        load_builtin_index(&locale->word_index, &locale->settings, &locale->word_container.words);
+      } else {
+        ok = load_dictionary(locale->dict_file, &locale->word_container, &locale->matcher, &from_cache,
+                             [&](uint ready, float progress) { publish(index, ready, progress); });
+        if(from_cache) { publish(index, locale->word_container.words.size(), 1); }
+      }
+      cout << "Loaded " << locale->word_container.words.size() << " words"
+           << (from_cache ? " from cache" : "") << " in "
+           << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << "ms" << endl;
+      return ok;
+    }
+
+    void publish(uint index, uint ready, float progress) {
+      locales[index]->words_ready.store(ready, memory_order_release);
+      locales[index]->progress = progress;
+      notify(index);
+    }
+
+    // Everything for one locale, on whichever thread loads it. The first
+    // is built even if its file can't be read, and is searchable but empty.
+    bool load(uint index, uint profile) {
+      Locale* locale = locales[index];
+      TraceScope scope("load");
+      auto start = chrono::steady_clock::now();
+      apply_profile(&(*options.profiles)[profile], &locale->settings);
+      bool ok = index == 0 ? load_first_words(index) : load_words(index);
+      if(ok || index == 0) { build(locale, profile); }
+      if(index == 0 && options.engine != INDEX_ENGINE && !options.compact_words) {
+        cout << "Prefilter: " << prefilter_level_name(locale->prefilter.level) << endl;
+      }
+      locale->load_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+      return ok;
+    }
+
+    // profile is the one already applied to its settings
+    void build(Locale* locale, uint profile) {
+      if(locale->word_index.bucket_data == nullptr) { locale->word_index.build(&locale->word_container.words); }
+      if(options.engine != INDEX_ENGINE && !options.compact_words) {
+        locale->prefilter.build(&locale->word_container.words);
+      }
+      if(!options.freq_file.empty() && !locale->ranker.load_frequencies(options.freq_file, &locale->word_container.words)) {
+        cout << "Could not open file " << options.freq_file << endl;
+      }
+      locale->ranker.build(&locale->settings, &locale->word_container.words);
+      locale->runner = new QueryRunner(options.engine, &locale->settings, &locale->word_container,
+                                       &locale->word_index, &locale->matcher, options.pool,
+                                       &locale->query_cache, &locale->prefilter, &locale->ranker);
+      locale->runner->near_miss_distance = options.near_misses;
+      locale->runner->profiles = options.profiles;
+      locale->runner->set_profile(profile);
+      if(options.compact_words) { compact(locale); }
+    }
+
+    void compact(Locale* locale) {
+      auto start = chrono::steady_clock::now();
+      WordContainer* word_container = &locale->word_container;
+      size_t bytes = word_container->words.capacity()*sizeof(DictionaryWord);
+      for(const DictionaryWord& word : word_container->words) {
+        bytes += word.word.size() + word.ipa.size() + 2;
+      }
+      word_container->compact_words();
+      cout << "Compacted " << locale->name << ": " << bytes/1024 << "KB of words and views to "
+           << word_container->compact.memory_bytes()/1024 << "KB in "
+           << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << "ms" << endl;
+    }
+
+    void loop() {
+      unique_lock<mutex> guard(lock);
+      while(true) {
+        wake.wait(guard, [&]{ return stopping || !pending.empty(); });
+        if(stopping) { return; }
+        uint index = pending.front().first;
+        uint profile = pending.front().second;
+        pending.erase(pending.begin());
+        guard.unlock();
+
+        Locale* locale = locales[index];
+        bool ok = load(index, profile);
+
+        guard.lock();
+        locale->loading = false;
+        locale->failed = !ok && index != 0;
+        locale->loaded = ok || index == 0;
+        guard.unlock();
+        if(locale->loaded) { report(locale); }
+        notify(index);
+        guard.lock();
+      }
+    }
+
+  public:
+    vector<Locale*> locales;
+
+    LocaleSet(const LocaleOptions* options, function<void(uint)> notify) : partial_compiler(&partial_settings) {
+      this->options = *options;
+      this->notify = notify;
+    }
+
+    ~LocaleSet() {
+      if(loader.joinable()) {
+        {
+          lock_guard<mutex> guard(lock);
+          stopping = true;
+        }
+        wake.notify_all();
+        loader.join();
+      }
+      for(Locale* locale : locales) {
+        delete locale;
+      }
+    }
+
+    // The first must be loaded before the rest, by load_first or request
+    uint add(string name, string dict_file) {
+      PhonemeSymbols* shared_symbols = locales.empty() ? nullptr : locales[0]->matcher.symbols;
+      Locale* locale = new Locale(name, dict_file, shared_symbols, options.query_cache_bytes);
+      locale->matcher.symbols_lock = &symbols_lock;
+      locales.push_back(locale);
+      return locales.size() - 1;
+    }
+
+    // The first one on this thread, rather than with request
+    bool load_first(uint profile) {
+      bool ok = load(0, profile);
+      locales[0]->loaded = true;
+      report(locales[0]);
+      return ok;
+    }
+
+    // Starts loading a locale in the background with the given profile,
+    // unless it's loaded or on its way. False once it has failed.
+    bool request(uint index, uint profile) {
+      lock_guard<mutex> guard(lock);
+      Locale* locale = locales[index];
+      if(locale->failed) { return false; }
+      if(locale->loaded || locale->loading) { return true; }
+      locale->loading = true;
+      pending.push_back(make_pair(index, profile));
+      if(!loader.joinable()) { loader = thread(&LocaleSet::loop, this); }
+      wake.notify_all();
+      return true;
+    }
+
+    // A three digit query against the words a locale has read so far,
+    // before it's loaded: regex only, unranked and without near misses.
+    // Long numbers and lookups wait for it. Search thread only.
+    void search_partial(const SearchQuery* query, SearchResult* result, const atomic<bool>* cancelled) {
+      TraceScope scope("partial");
+      result->pattern.clear();
+      result->match_indexes.clear();
+      result->exact_count = 0;
+      result->long_number.clear();
+      result->segmentations.clear();
+      result->lookup_word.clear();
+      result->lookup_codes.clear();
+      Locale* locale = locales[query->locale];
+      uint ready = locale->words_ready.load(memory_order_acquire);
+      if(ready == 0 || !query->long_number.empty() || !query->lookup_word.empty()) { return; }
+      apply_profile(&(*options.profiles)[query->profile], &partial_settings);
+      partial_settings.triple_mode = query->triple_mode;
+      partial_settings.strict_mode = query->strict_mode;
+      partial_compiler.compile_pattern(query->digit1, query->digit2, query->digit3, &result->pattern);
+      regex pattern(result->pattern, regex::extended);
+      // Keeps the words if the loader compacts them meanwhile
+      WordContainer* word_container = &locale->word_container;
+      word_container->expand();
+      parallel_filter(options.pool, ready, [&](uint i) {
+        string_view ipa = word_container->words[i].ipa;
+        return regex_match(ipa.begin(), ipa.end(), pattern);
+      }, &result->match_indexes, cancelled);
+      word_container->release();
+      result->exact_count = result->match_indexes.size();
+    }
+
+    bool failed(uint index) {
+      lock_guard<mutex> guard(lock);
+      return locales[index]->failed;
+    }
+
+    void report(const Locale* locale) {
+      cout << "Locale " << locale->name << ": " << locale->word_container.size() << " words in "
+           << locale->load_ms << "ms, " << locale->memory_bytes()/1024 << "KB";
+      if(locale->shared_string_bytes > 0) {
+        cout << " (" << locale->shared_string_bytes/1024 << "KB of strings shared)";
+      }
+      cout << endl;
+    }
+};
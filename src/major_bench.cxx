@@ -0,0 +1,311 @@
+// Benchmarks for the search pipeline, without FLTK: dictionary loading,
+// pattern compiling, regex construction and filtering for every number in
+// both modes. Prints one JSON object per stage so runs can be diffed.
+//
+// Usage: major_bench [--dict=FILE] [--stride=N] [--repeats=N] [--strict]
+//                    [--prefilter=scalar|sse2|avx2]
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "builtin_dictionary.h"
+#include "phoneme_matcher.h"
+#include "phonetics.h"
+#include "prefilter.h"
+#include "word_index.h"
+
+
+using namespace std;
+
+struct BenchOptions {
+  string dict_file = "ipa-dict-en_UK.txt";
+  // Every stride'th code, the regex filter takes most of a minute at 1
+  uint stride = 1;
+  // Times each load is repeated
+  uint repeats = 20;
+  bool strict_mode = false;
+  // Lower than the CPU's best to compare, see prefilter.h
+  bool force_prefilter = false;
+  PrefilterLevel prefilter_level = SCALAR_PREFILTER;
+};
+
+// Peak resident set so far, in KB
+long peak_rss_kb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+double microseconds_since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+// Nearest-rank percentile of sorted samples
+double percentile(const vector<double>* sorted, double p) {
+  if(sorted->empty()) { return 0; }
+  size_t rank = (size_t)(p/100 * sorted->size() + 0.5);
+  rank = min(max(rank, (size_t)1), sorted->size());
+  return (*sorted)[rank-1];
+}
+
+double sum(const vector<double>* samples) {
+  double total = 0;
+  for(double sample : *samples) { total += sample; }
+  return total;
+}
+
+// One line per stage, times in microseconds. extra is more JSON fields.
+void report(const char* stage, vector<double>* samples, uint64_t items = 0, string extra = "") {
+  sort(samples->begin(), samples->end());
+  double total = sum(samples);
+  printf("{\"stage\":\"%s\",\"samples\":%zu,\"total_ms\":%.3f,\"min_us\":%.2f,\"p50_us\":%.2f,"
+         "\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f,\"per_second\":%.1f",
+         stage, samples->size(), total/1000, percentile(samples, 0), percentile(samples, 50),
+         percentile(samples, 90), percentile(samples, 99), percentile(samples, 100),
+         total > 0 ? samples->size() / (total/1e6) : 0.0);
+  if(items > 0) {
+    printf(",\"items\":%llu,\"items_per_second\":%.1f", (unsigned long long)items,
+           total > 0 ? items / (total/1e6) : 0.0);
+  }
+  printf("%s,\"peak_rss_kb\":%ld}\n", extra.c_str(), peak_rss_kb());
+  fflush(stdout);
+}
+
+int run_bench(const BenchOptions* options) {
+  ifstream file(options->dict_file, ios::binary);
+  if(!file) {
+    cerr << "Could not open file " << options->dict_file << endl;
+    return 1;
+  }
+  string text((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+  printf("{\"bench\":\"major_bench\",\"dict\":\"%s\",\"bytes\":%zu,\"stride\":%u,\"strict\":%s}\n",
+         options->dict_file.c_str(), text.size(), options->stride, options->strict_mode ? "true" : "false");
+
+  // WordContainer construction, from text already in memory, from the file
+  // and from the compiled tables
+  vector<double> samples;
+  uint64_t lines = 0;
+  for(uint i=0; i<options->repeats; i++) {
+    auto start = chrono::steady_clock::now();
+    WordContainer word_container(&text);
+    samples.push_back(microseconds_since(start));
+    lines += word_container.words.size();
+  }
+  report("load_text", &samples, lines);
+
+  samples.clear();
+  lines = 0;
+  for(uint i=0; i<options->repeats; i++) {
+    auto start = chrono::steady_clock::now();
+    WordContainer word_container(options->dict_file);
+    samples.push_back(microseconds_since(start));
+    lines += word_container.words.size();
+  }
+  report("load_file", &samples, lines);
+
+  PhonemePatternSettings settings;
+  settings.strict_mode = options->strict_mode;
+  samples.clear();
+  for(uint i=0; i<options->repeats; i++) {
+    WordContainer word_container;
+    PhonemeMatcher matcher(&settings);
+    auto start = chrono::steady_clock::now();
+    load_builtin_dictionary(&word_container, &matcher);
+    samples.push_back(microseconds_since(start));
+  }
+  report("load_builtin", &samples, uint64_t(options->repeats) * compiled_dictionary::num_words);
+
+  // Everything below searches the file's words
+  WordContainer word_container(options->dict_file);
+  PhonemeMatcher matcher(&settings);
+  matcher.tokenize(&word_container.words);
+  WordIndex word_index(&settings);
+  samples.clear();
+  auto start = chrono::steady_clock::now();
+  word_index.build(&word_container.words);
+  samples.push_back(microseconds_since(start));
+  report("index_build", &samples, word_container.words.size());
+
+  BytePrefilter prefilter;
+  if(options->force_prefilter && !prefilter.lower_to(options->prefilter_level)) {
+    cerr << "Prefilter: " << prefilter_level_name(options->prefilter_level) << " unsupported, using "
+         << prefilter_level_name(prefilter.level) << endl;
+  }
+  samples.clear();
+  start = chrono::steady_clock::now();
+  prefilter.build(&word_container.words);
+  samples.push_back(microseconds_since(start));
+  report("prefilter_build", &samples, word_container.words.size());
+
+  // The same words front coded, see front_coded.h: bytes against the views
+  // plus their strings, random access as the table draws rows, and one
+  // decode of every word in order as a scan does
+  WordContainer compacted(options->dict_file);
+  size_t string_bytes = 0;
+  for(const DictionaryWord& word : compacted.words) {
+    string_bytes += word.word.size() + word.ipa.size() + 2;
+  }
+  size_t view_bytes = compacted.words.capacity()*sizeof(DictionaryWord);
+  samples.clear();
+  start = chrono::steady_clock::now();
+  compacted.compact_words();
+  samples.push_back(microseconds_since(start));
+  char compact_extra[160];
+  snprintf(compact_extra, sizeof(compact_extra), ",\"view_bytes\":%zu,\"string_bytes\":%zu,\"compact_bytes\":%zu,"
+           "\"reduction\":%.2f", view_bytes, string_bytes, compacted.compact.memory_bytes(),
+           (double)(view_bytes + string_bytes) / compacted.compact.memory_bytes());
+  report("compact_build", &samples, compacted.size(), compact_extra);
+
+  FrontCodedReader reader;
+  samples.clear();
+  uint64_t decoded_bytes = 0;
+  uint random = 1;
+  for(uint i=0; i<options->repeats; i++) {
+    start = chrono::steady_clock::now();
+    for(uint j=0; j<10000; j++) {
+      random = random*1103515245 + 12345;
+      decoded_bytes += compacted.get(random % compacted.size(), &reader).word.size();
+    }
+    samples.push_back(microseconds_since(start));
+  }
+  report("compact_random_access", &samples, uint64_t(options->repeats) * 10000);
+
+  samples.clear();
+  for(uint i=0; i<options->repeats; i++) {
+    start = chrono::steady_clock::now();
+    for(uint j=0; j<compacted.size(); j++) {
+      decoded_bytes += compacted.get(j, &reader).ipa.size();
+    }
+    samples.push_back(microseconds_since(start));
+  }
+  snprintf(compact_extra, sizeof(compact_extra), ",\"decoded_bytes\":%llu", (unsigned long long)decoded_bytes);
+  report("compact_decode_all", &samples, uint64_t(options->repeats) * compacted.size(), compact_extra);
+
+  DigitPatternCompiler compiler(&settings);
+  vector<uint> codes;
+  for(uint code=0; code<NUM_CODES; code+=options->stride) { codes.push_back(code); }
+
+  vector<double> compile_samples, regex_samples, filter_samples, compact_filter_samples;
+  vector<double> dfa_compile_samples, dfa_filter_samples, index_samples;
+  // Prefilter alone, then prefilter plus the exact engine on its survivors
+  vector<double> prefilter_samples, prefiltered_regex_samples, prefiltered_dfa_samples;
+  uint64_t regex_matches = 0, dfa_matches = 0, index_matches = 0, compact_matches = 0;
+  uint64_t candidates_total = 0, prefiltered_regex_matches = 0, prefiltered_dfa_matches = 0;
+  vector<uint> matches, candidates;
+  for(PhonemeTripleMode mode : {CCC, CVC}) {
+    settings.triple_mode = mode;
+    for(uint code : codes) {
+      uint8_t digit1 = code/100, digit2 = code/10%10, digit3 = code%10;
+
+      start = chrono::steady_clock::now();
+      string pattern_str = compiler.compile_pattern(digit1, digit2, digit3);
+      compile_samples.push_back(microseconds_since(start));
+
+      start = chrono::steady_clock::now();
+      regex pattern(pattern_str, regex::extended);
+      regex_samples.push_back(microseconds_since(start));
+
+      start = chrono::steady_clock::now();
+      regex_matches += word_container.set_filter(&pattern);
+      filter_samples.push_back(microseconds_since(start));
+
+      start = chrono::steady_clock::now();
+      compact_matches += compacted.set_filter(&pattern);
+      compact_filter_samples.push_back(microseconds_since(start));
+
+      start = chrono::steady_clock::now();
+      PhonemeDfa dfa = matcher.compile(digit1, digit2, digit3);
+      dfa_compile_samples.push_back(microseconds_since(start));
+
+      start = chrono::steady_clock::now();
+      dfa_matches += matcher.filter(&dfa, &matches);
+      dfa_filter_samples.push_back(microseconds_since(start));
+
+      start = chrono::steady_clock::now();
+      PrefilterPattern prefilter_pattern = prefilter.compile(&settings, digit1, digit2, digit3);
+      candidates_total += prefilter.filter(&prefilter_pattern, &candidates);
+      double prefilter_us = microseconds_since(start);
+      prefilter_samples.push_back(prefilter_us);
+
+      start = chrono::steady_clock::now();
+      prefiltered_regex_matches += word_container.filter(&pattern, &candidates, &matches);
+      prefiltered_regex_samples.push_back(prefilter_us + microseconds_since(start));
+
+      start = chrono::steady_clock::now();
+      prefiltered_dfa_matches += matcher.filter(&dfa, &candidates, &matches);
+      prefiltered_dfa_samples.push_back(prefilter_us + microseconds_since(start));
+
+      start = chrono::steady_clock::now();
+      WordBucket bucket = word_index.get_bucket(mode, options->strict_mode, code);
+      index_matches += word_container.set_filter(bucket.begin(), bucket.end());
+      index_samples.push_back(microseconds_since(start));
+    }
+  }
+  uint64_t words_scanned = uint64_t(2*codes.size()) * word_container.words.size();
+  report("compile_pattern", &compile_samples);
+  report("regex_construct", &regex_samples);
+  report("set_filter_regex", &filter_samples, words_scanned);
+  char slowdown[64];
+  snprintf(slowdown, sizeof(slowdown), ",\"slowdown\":%.3f", sum(&compact_filter_samples) / sum(&filter_samples));
+  report("set_filter_regex_compact", &compact_filter_samples, words_scanned, slowdown);
+  report("dfa_compile", &dfa_compile_samples);
+  report("filter_dfa", &dfa_filter_samples, words_scanned);
+  report("index_lookup", &index_samples, index_matches);
+
+  double rejection_rate = 1 - (double)candidates_total / words_scanned;
+  double regex_total = sum(&filter_samples), dfa_total = sum(&dfa_filter_samples);
+  char extra[128];
+  snprintf(extra, sizeof(extra), ",\"level\":\"%s\",\"candidates\":%llu,\"rejection_rate\":%.5f",
+           prefilter_level_name(prefilter.level), (unsigned long long)candidates_total, rejection_rate);
+  report("prefilter", &prefilter_samples, words_scanned, extra);
+  snprintf(extra, sizeof(extra), ",\"speedup\":%.2f", regex_total / sum(&prefiltered_regex_samples));
+  report("set_filter_regex_prefiltered", &prefiltered_regex_samples, words_scanned, extra);
+  snprintf(extra, sizeof(extra), ",\"speedup\":%.2f", dfa_total / sum(&prefiltered_dfa_samples));
+  report("filter_dfa_prefiltered", &prefiltered_dfa_samples, words_scanned, extra);
+
+  printf("{\"matches_regex\":%llu,\"matches_dfa\":%llu,\"matches_index\":%llu,"
+         "\"matches_regex_prefiltered\":%llu,\"matches_dfa_prefiltered\":%llu,\"peak_rss_kb\":%ld}\n",
+         (unsigned long long)regex_matches, (unsigned long long)dfa_matches, (unsigned long long)index_matches,
+         (unsigned long long)prefiltered_regex_matches, (unsigned long long)prefiltered_dfa_matches, peak_rss_kb());
+  return regex_matches == dfa_matches && dfa_matches == index_matches && compact_matches == regex_matches
+         && prefiltered_regex_matches == regex_matches && prefiltered_dfa_matches == dfa_matches ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  for(int i=1; i<argc; i++) {
+    if(strncmp(argv[i], "--dict=", 7) == 0) {
+      options.dict_file = argv[i] + 7;
+    } else if(strncmp(argv[i], "--stride=", 9) == 0) {
+      options.stride = max(1, atoi(argv[i] + 9));
+    } else if(strncmp(argv[i], "--repeats=", 10) == 0) {
+      options.repeats = max(1, atoi(argv[i] + 10));
+    } else if(strcmp(argv[i], "--strict") == 0) {
+      options.strict_mode = true;
+    } else if(strcmp(argv[i], "--prefilter=scalar") == 0) {
+      options.force_prefilter = true;
+      options.prefilter_level = SCALAR_PREFILTER;
+    } else if(strcmp(argv[i], "--prefilter=sse2") == 0) {
+      options.force_prefilter = true;
+      options.prefilter_level = SSE2_PREFILTER;
+    } else if(strcmp(argv[i], "--prefilter=avx2") == 0) {
+      options.force_prefilter = true;
+      options.prefilter_level = AVX2_PREFILTER;
+    } else {
+      cout << "Usage: " << argv[0] << " [--dict=FILE] [--stride=N] [--repeats=N] [--strict]"
+           << " [--prefilter=scalar|sse2|avx2]" << endl;
+      return 1;
+    }
+  }
+  return run_bench(&options);
+}
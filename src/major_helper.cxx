@@ -3,19 +3,44 @@
 #include <FL/Fl_Box.H>
 #include <FL/Fl_Button.H>
 #include <FL/Fl_Check_Button.H>
+#include <FL/Fl_Choice.H>
 #include <FL/Fl_Input.H>
+#include <FL/Fl_Progress.H>
 #include <FL/Fl_Table.H>
 #include <FL/Fl_Window.H>
 #include <FL/fl_draw.H>
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <regex>
 #include <sstream>
 #include <vector>
 
+#include "async_search.h"
+#include "batch.h"
+#include "builtin_dictionary.h"
+#include "dictionary_cache.h"
+#include "locales.h"
+#include "mapping_profile.h"
 #include "phonetics.h"
-#include "wordlists.h"
+#include "phoneme_matcher.h"
+#include "prefilter.h"
+#include "query_cache.h"
+#include "query_runner.h"
+#include "ranker.h"
+#include "segmenter.h"
+#include "server.h"
+#include "trace.h"
+#include "word_index.h"
+
+// Only major_check links the counting operator new, see CMakeLists.txt
+#ifdef CHECK_ALLOCATIONS
+#include "allocation_counter.h"
+#endif
 
 
 // https://www.fltk.org/doc-1.3/common.html
@@ -32,20 +57,19 @@
 using namespace std;
 // use std::variant
 
-const regex ISNUM_REGEX = regex("[0-9]{1,3}", regex::extended);
+const regex WORD_REGEX = regex("[A-Za-z'.-]+", regex::extended);
 const int WIN_WIDTH = 340;
 const int WIN_HEIGHT = 600;
+const size_t QUERY_CACHE_BYTES = 16 << 20;
 
 class WordTable : public Fl_Table {
   private:
     WordContainer *word_container;
+    // Decodes rows of a compacted dictionary
+    FrontCodedReader reader;
 
     void event_callback() {
-      int r = callback_row();
-      int c = callback_col();
-      TableContext context = callback_context();
-      fprintf(stderr, "callback: Row=%d Col=%d Context=%d Event=%d\n",
-              r, c, (int)context, (int)Fl::event());
+      tracer.instant("table event");
     }
 
     static void event_callback_wrapper(Fl_Widget* o, void* data) {
@@ -70,26 +94,36 @@ class WordTable : public Fl_Table {
       fl_pop_clip();
     }
 
+    void draw() {
+      TraceScope scope("redraw");
+      Fl_Table::draw();
+    }
+
     void draw_cell(TableContext context, int row=0, int col=0, int x=0, int y=0, int w=0, int h=0) {
       switch(context) {
         case CONTEXT_STARTPAGE:
 
           return;
         case CONTEXT_COL_HEADER:
-          DrawHeader(col==0 ? "Word" : "IPA", x,y,w,h);
+          if(showing_text) {
+            DrawHeader(text_headers[col], x,y,w,h);
+          } else {
+            DrawHeader(col==0 ? "Word" : "IPA", x,y,w,h);
+          }
           return;
         case CONTEXT_CELL:
           {
             // DictionaryWord* word = &word_container->words[row];
             //if(word_container->match_indexes.size() > 0) {
-            if(valid_input) {
-              // cout << "Row " << row << ", match_indexes " << word_container->match_indexes.size() << endl;
+            if(showing_text) {
+              DrawData(text_cells[col][row].c_str(), x,y,w,h);
+            } else if(valid_input) {
               uint index = word_container->match_indexes[row];
-              DictionaryWord* word = &word_container->words[index];
-              DrawData(col==0 ? word->word.c_str() : word->ipa.c_str(), x,y,w,h);
+              DictionaryWord word = word_container->get(index, &reader);
+              DrawData(col==0 ? word.word.data() : word.ipa.data(), x,y,w,h);
             } else { 
-              DictionaryWord* word = &word_container->words[row];
-              DrawData(col==0 ? word->word.c_str() : word->ipa.c_str(), x,y,w,h);
+              DictionaryWord word = word_container->get(row, &reader);
+              DrawData(col==0 ? word.word.data() : word.ipa.data(), x,y,w,h);
             }
           }
           return;
@@ -100,10 +134,29 @@ class WordTable : public Fl_Table {
 
   public:
     bool valid_input = False;
+    // Rows are text_cells rather than dictionary words, e.g. splits of a
+    // long number
+    bool showing_text = false;
+    const char* text_headers[2] = {"", ""};
+    vector<string> text_cells[2];
+
+    // Rows index into these words from now on
+    void set_words(WordContainer* word_container) {
+      this->word_container = word_container;
+    }
+
+    void show_text(const char* header0, const char* header1) {
+      text_headers[0] = header0;
+      text_headers[1] = header1;
+      showing_text = true;
+      valid_input = True;
+      rows(text_cells[0].size());
+      redraw();
+    }
     WordTable(int x, int y, int w, int h, WordContainer* word_container, const char *L=0) : Fl_Table(x,y,w,h,L) {
       this->word_container = word_container;
       // rows
-      rows(word_container->words.size());
+      rows(word_container->size());
       row_header(0);
 
       // cols
@@ -125,39 +178,211 @@ class MainGui {
     Fl_Input* input;
     Fl_Check_Button* switch_ccc_cvc;
     Fl_Check_Button* switch_strict;
+    // Only shown with more than one profile
+    Fl_Choice* profile_choice;
+    // Only shown with more than one dictionary
+    Fl_Choice* locale_choice;
     Fl_Box* pattern_label;
     Fl_Box* error_box;
+    // Latency of the last input, and query cache counts
+    Fl_Box* status_bar;
+    string status;
+    // Over the status bar's right end while the chosen dictionary loads
+    Fl_Progress* progress_bar;
+    string progress_text;
+    // Per dictionary, whether its words are held with expand() until it
+    // has loaded, as rows show them while it loads and the loader would
+    // otherwise free them to compact them. See hold_words.
+    vector<bool> holding;
+    // The last input ran before the chosen dictionary had loaded
+    bool showing_partial = false;
+    chrono::steady_clock::time_point input_time;
+    // The dictionary whose words are in the table
     WordContainer* word_container;
+    // For words of a compacted dictionary, see LocaleOptions::compact_words
+    FrontCodedReader reader;
+    MatchEngine engine;
+    WorkerPool* pool;
     WordTable* word_table;
     PhonemePatternSettings* pattern_settings;
-    DigitPatternCompiler* pattern_compiler;
+    AsyncSearch* search;
+    // Each dictionary with its own settings, index and runner for the
+    // search thread, pattern_settings belongs to the GUI
+    LocaleSet* locales;
+    // Chosen in locale_choice, searched once it has loaded
+    uint locale = 0;
+    // Last result taken, kept so its buffers are reused
+    SearchResult displayed;
+    // Whether the search thread has indexed the chosen dictionary and
+    // profile for lookups, it does on the first word typed
+    bool lookups_indexed = false;
+    const vector<MappingProfile>* profiles;
+    uint profile;
     string current_pattern = "";
 
+    // Fl::awake'd on the main thread once the search thread has a result
+    void show_search_result() {
+      if(!search->take_result(&displayed)) { return; }
+      TraceScope scope("show");
+      show_words(displayed.locale);
+      if(!displayed.long_number.empty()) {
+        show_splits(&displayed);
+        show_latency("Splits");
+        return;
+      }
+      if(!displayed.lookup_word.empty()) {
+        show_lookup(&displayed);
+        show_latency("Lookup");
+        return;
+      }
+      word_table->showing_text = false;
+      word_container->match_indexes.swap(displayed.match_indexes);
+      current_pattern.swap(displayed.pattern);
+      uint near = word_container->match_indexes.size() - displayed.exact_count;
+      if(near > 0) {
+        current_pattern.append("  +").append(to_string(near)).append(" near");
+      }
+      // Run again in full once loaded, see on_locale_loaded
+      if(!locales->locales[displayed.locale]->loaded) {
+        current_pattern.append("  (loading)");
+      }
+      pattern_label->label(current_pattern.c_str());
+      word_table->rows(word_container->match_indexes.size());
+      word_table->valid_input = True;
+      word_table->redraw();
+      show_latency("Results");
+    }
+
+    // From the input changing to the table being given its rows, the draw
+    // itself follows
+    void show_latency(const char* what) {
+      double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - input_time).count();
+      char text[160];
+      int size = snprintf(text, sizeof(text), "%s in %.2fms", what, ms);
+      if(engine != INDEX_ENGINE) {
+        QueryCache* query_cache = &locales->locales[locale]->query_cache;
+        snprintf(text + size, sizeof(text) - size, ", cache %llu hits %llu refined %llu misses",
+                 (unsigned long long)query_cache->hits, (unsigned long long)query_cache->refinements,
+                 (unsigned long long)query_cache->misses);
+      }
+      status = text;
+      status_bar->label(status.c_str());
+    }
+
+    void show_words(uint index) {
+      word_container = &locales->locales[index]->word_container;
+      word_table->set_words(word_container);
+    }
+
+    // Rows there are to show for the chosen dictionary, so far if it's loading
+    uint words_shown() {
+      const Locale* current = locales->locales[locale];
+      return current->loaded ? current->word_container.size() : current->words_ready.load();
+    }
+
+    // One row per split, showing the first word for each run of digits
+    void show_splits(const SearchResult* result) {
+      word_table->text_cells[0].clear();
+      word_table->text_cells[1].clear();
+      for(const Segmentation& segmentation : result->segmentations) {
+        string words, digits;
+        for(const CodeSegment& segment : segmentation) {
+          if(!words.empty()) {
+            words.push_back(' ');
+            digits.push_back(' ');
+          }
+          words.append(word_container->get(*segment.words.begin(), &reader).word);
+          digits.append(result->long_number, segment.begin, segment.length);
+        }
+        word_table->text_cells[0].push_back(words);
+        word_table->text_cells[1].push_back(digits);
+      }
+      if(result->segmentations.empty()) {
+        current_pattern = "No way to split into words";
+      } else {
+        current_pattern = to_string(result->segmentations.size()) + " splits, fewest "
+                          + to_string(result->segmentations[0].size()) + " words";
+      }
+      pattern_label->label(current_pattern.c_str());
+      word_table->show_text("Words", "Digits");
+    }
+
+    // Word -> number, the rows are the words starting with it
+    void show_lookup(const SearchResult* result) {
+      lookups_indexed = true;
+      word_table->text_cells[0].clear();
+      word_table->text_cells[1].clear();
+      for(uint i=0; i<result->match_indexes.size(); i++) {
+        const string& code = result->lookup_codes[i];
+        word_table->text_cells[0].push_back(string(word_container->get(result->match_indexes[i], &reader).word));
+        word_table->text_cells[1].push_back(code.empty() ? "-" : code);
+      }
+      const string& word = result->lookup_word;
+      if(result->exact_count > 0) {
+        const string& code = result->lookup_codes[0];
+        current_pattern = word + (code.empty() ? " has no number" : " is " + code);
+      } else {
+        uint found = result->match_indexes.size();
+        current_pattern = (found < MAX_LOOKUPS ? to_string(found) : "Many") + " words starting " + word;
+      }
+      pattern_label->label(current_pattern.c_str());
+      word_table->show_text("Word", "Number");
+    }
+
+    static void on_search_done(void* data) {
+      ((MainGui*)data)->show_search_result();
+    }
+
     void on_input_update(Fl_Input* input) {
-      cout << "Value: " << input->value() << endl;
+      TraceScope scope("parse");
+      input_time = chrono::steady_clock::now();
       smatch match;
       string s = input->value();
-      bool result = regex_match(s, match, ISNUM_REGEX);
-      if (result) {
-        error_box->hide();
-        uint digit1 = 0;
-        uint digit2 = 0;
-        uint digit3 = 0;
-        cout << "Digits pre:  " << digit1 << digit2 << digit3 << endl;
-        set_digits(&s, &digit1, &digit2, &digit3);
-        cout << "Digits post: " << digit1 << digit2 << digit3 << endl;
-        string pattern_str = pattern_compiler->compile_pattern(digit1, digit2, digit3);
-        current_pattern = pattern_str;
+      const Locale* current = locales->locales[locale];
+      // Checked by hand, regex_match allocates
+      bool digits = !s.empty() && all_of(s.begin(), s.end(), [](char c) { return c >= '0' && c <= '9'; });
+      // While it loads, numbers search and the table lists the words so
+      // far, the rest waits
+      bool partial = current->words_ready > 0 && (s.empty() || (digits && s.size() <= 3));
+      showing_partial = !current->loaded;
+      if(!current->loaded && !partial) {
+        search->cancel();
+        current_pattern = (locales->failed(locale) ? "Could not load " : "Loading ") + current->name;
         pattern_label->label(current_pattern.c_str());
-        regex pattern = regex(pattern_str, regex::extended);
-        uint num_matches = word_container->set_filter(pattern);
-        word_table->rows(num_matches);
-        word_table->valid_input = True;
-        word_table->redraw();
+        return;
+      }
+      SearchQuery query;
+      query.triple_mode = pattern_settings->triple_mode;
+      query.strict_mode = pattern_settings->strict_mode;
+      query.profile = profile;
+      query.locale = locale;
+      // Results arrive in show_search_result
+      if(digits && s.size() <= 3) {
+        error_box->hide();
+        set_digits(&s, &query.digit1, &query.digit2, &query.digit3);
+        search->submit(query);
+      } else if(digits) {
+        error_box->hide();
+        // Split into words by their whole code, see segmenter.h
+        query.long_number = s;
+        search->submit(query);
+      } else if(regex_match(s, match, WORD_REGEX)) {
+        error_box->hide();
+        transform(s.begin(), s.end(), s.begin(), ::tolower);
+        query.lookup_word = s;
+        search->submit(query);
+        // The first word typed indexes the dictionary, see QueryRunner::look_up
+        if(!lookups_indexed) {
+          current_pattern = "Indexing " + current->name + "…";
+          pattern_label->label(current_pattern.c_str());
+        }
       } else {
+        search->cancel();
+        show_words(locale);
         error_box->show();
         pattern_label->label("");
-        word_table->rows(word_container->words.size());
+        word_table->rows(words_shown());
+        word_table->showing_text = false;
         word_table->valid_input = False;
         word_table->redraw();
       }
@@ -170,7 +395,6 @@ class MainGui {
   
     void on_ccc_cvc_changed(Fl_Check_Button* button) {
       pattern_settings->triple_mode = button->value() == 0 ? CCC : CVC;
-      cout << "ccc_cvc changed " << button->value() << endl;
       on_input_update(input);
     }
   
@@ -182,7 +406,6 @@ class MainGui {
     void on_strict_changed(Fl_Check_Button* button) {
       // inverted logic because button says "incomplete match" aka ticked is unstrict
       pattern_settings->strict_mode = button->value() == 0 ? True : False;
-      cout << "strict changed " << button->value() << endl;
       on_input_update(input);
     }
   
@@ -191,8 +414,83 @@ class MainGui {
       ((MainGui*)f)->on_strict_changed(button);
     }
 
+    // The search thread switches its own settings when the next query
+    // carries the new profile
+    void on_profile_changed(Fl_Choice* choice) {
+      profile = choice->value();
+      apply_profile(&(*profiles)[profile], pattern_settings);
+      lookups_indexed = false;
+      on_input_update(input);
+    }
+
+    static void on_profile_callback_wrapper(Fl_Widget* o, void* f) {
+      Fl_Choice* choice = (Fl_Choice*)o;
+      ((MainGui*)f)->on_profile_changed(choice);
+    }
+
+    // Loaded in the background the first time, see on_locale_loaded
+    void on_locale_changed(Fl_Choice* choice) {
+      locale = choice->value();
+      lookups_indexed = false;
+      hold_words(locale);
+      locales->request(locale, profile);
+      on_input_update(input);
+    }
+
+    static void on_locale_callback_wrapper(Fl_Widget* o, void* f) {
+      Fl_Choice* choice = (Fl_Choice*)o;
+      ((MainGui*)f)->on_locale_changed(choice);
+    }
+
+    // Before a dictionary that may still be loading is shown
+    void hold_words(uint index) {
+      Locale* l = locales->locales[index];
+      if(holding[index] || l->loaded || locales->failed(index)) { return; }
+      l->word_container.expand();
+      holding[index] = true;
+    }
+
+    // Fl::awake'd on the main thread as a dictionary's words arrive and
+    // once it has loaded. A result from the words so far is run again, the
+    // list of all words grows as they come.
+    static void on_locale_loaded(void* data) {
+      ((MainGui*)data)->on_locale_progress();
+    }
+
+    void on_locale_progress() {
+      for(uint i=0; i<holding.size(); i++) {
+        if(holding[i] && (locales->locales[i]->loaded || locales->failed(i))) {
+          locales->locales[i]->word_container.release();
+          holding[i] = false;
+        }
+      }
+      const Locale* current = locales->locales[locale];
+      if(current->loaded || locales->failed(locale)) {
+        progress_bar->hide();
+      } else {
+        progress_text = (current->progress < 1 ? "Loading " : "Indexing ") + current->name;
+        progress_bar->label(progress_text.c_str());
+        progress_bar->value(current->progress);
+        progress_bar->show();
+      }
+      if(showing_partial && (current->loaded || !word_table->valid_input)) {
+        on_input_update(input);
+      }
+    }
+
   public:
-    MainGui() {
+    // dict_file is an external IPA dictionary, empty for the built-in one.
+    // more_locales are (name, file) for dictionaries loaded when chosen.
+    // freq_file is an optional word frequency list for ranking.
+    // near_misses is the most edits a near miss can be, 0 for none.
+    // profiles are the digit mappings to choose from, starting with profile.
+    MainGui(MatchEngine engine, uint num_threads, string dict_file, const vector<pair<string, string>>* more_locales,
+            string freq_file, uint near_misses, const vector<MappingProfile>* profiles, uint profile,
+            bool compact_words) {
+      this->engine = engine;
+      this->profiles = profiles;
+      this->profile = profile;
+      this->pool = new WorkerPool(num_threads);
       this->window = new Fl_Window(WIN_WIDTH, WIN_HEIGHT);
 
       this->switch_ccc_cvc= new Fl_Check_Button(0, 0, 40, 20, "Second digit vowel");
@@ -203,41 +501,436 @@ class MainGui {
       this->switch_strict->value(1);
       this->switch_strict->callback(on_strict_callback_wrapper, (void*)this);
 
-      this->input = new Fl_Input(WIN_WIDTH/2-20, 30, 40, 20, "Number");
+      this->input = new Fl_Input(WIN_WIDTH/2-60, 30, 160, 20, "Number");
       input->callback(on_input_update_callback, (void*)this);
       input->when(FL_WHEN_CHANGED);
 
       this->pattern_label = new Fl_Box(0, 60, WIN_WIDTH, 20, "");
       pattern_label->box(FL_NO_BOX);
 
-      this->error_box = new Fl_Box(0, 80, WIN_WIDTH, 20, "Input must be number 0-999");
+      this->error_box = new Fl_Box(0, 80, WIN_WIDTH, 20, "Input must be a number or word");
       error_box->box(FL_NO_BOX);
       error_box->labelcolor(FL_RED);
 
-      WordContainer* word_container = new WordContainer(&defaults::english_ipa_str);
-      this->word_container = word_container;
-      this->word_table = new WordTable(0, 100, WIN_WIDTH, WIN_HEIGHT-100, word_container);
-
       this->pattern_settings = new PhonemePatternSettings();
-      this->pattern_compiler = new DigitPatternCompiler(pattern_settings);
-      cout << "Loaded " << this->word_container->words.size() << " words" << endl;
-      cout << "Vowels: '" << pattern_settings->any_vowel << "'" << endl;
-      //cout << "Pattern: '" << pattern_compiler->compile_pattern(1, 2, 3) << "'" << endl;
-      //cout << "First word " << word_container->get_word(0)->word << ", " << word_container->get_word(0)->ipa << endl;
+      apply_profile(&(*profiles)[profile], pattern_settings);
+      LocaleOptions locale_options;
+      locale_options.engine = engine;
+      locale_options.pool = pool;
+      locale_options.query_cache_bytes = QUERY_CACHE_BYTES;
+      locale_options.freq_file = freq_file;
+      locale_options.near_misses = near_misses;
+      locale_options.profiles = profiles;
+      locale_options.compact_words = compact_words;
+      this->locales = new LocaleSet(&locale_options, [this](uint) { Fl::awake(on_locale_loaded, this); });
+      locales->add(dict_file.empty() ? "en_UK" : dict_file.substr(dict_file.find_last_of('/') + 1), dict_file);
+      for(const pair<string, string>& more : *more_locales) {
+        locales->add(more.first, more.second);
+      }
+      holding.assign(locales->locales.size(), false);
+
+      int table_y = 100;
+      this->profile_choice = new Fl_Choice(WIN_WIDTH/2-60, table_y, 160, 20, "Profile");
+      for(const MappingProfile& p : *profiles) {
+        profile_choice->add(p.name.c_str());
+      }
+      profile_choice->value(profile);
+      profile_choice->callback(on_profile_callback_wrapper, (void*)this);
+      if(profiles->size() > 1) {
+        table_y += 30;
+      } else {
+        profile_choice->hide();
+      }
+      this->locale_choice = new Fl_Choice(WIN_WIDTH/2-60, table_y, 160, 20, "Dictionary");
+      for(const Locale* l : locales->locales) {
+        locale_choice->add(l->name.c_str());
+      }
+      locale_choice->value(0);
+      locale_choice->callback(on_locale_callback_wrapper, (void*)this);
+      if(locales->locales.size() > 1) {
+        table_y += 30;
+      } else {
+        locale_choice->hide();
+      }
+
+      this->word_container = &locales->locales[0]->word_container;
+      this->word_table = new WordTable(0, table_y, WIN_WIDTH, WIN_HEIGHT-table_y-20, word_container);
+      this->status_bar = new Fl_Box(0, WIN_HEIGHT-20, WIN_WIDTH, 20, "");
+      status_bar->box(FL_THIN_DOWN_BOX);
+      status_bar->align(FL_ALIGN_INSIDE | FL_ALIGN_LEFT);
+      this->progress_bar = new Fl_Progress(WIN_WIDTH-200, WIN_HEIGHT-20, 200, 20);
+      progress_bar->minimum(0);
+      progress_bar->maximum(1);
+      progress_bar->hide();
+      this->search = new AsyncSearch(
+        [this](const SearchQuery* query, SearchResult* result, const atomic<bool>* cancelled) {
+          result->locale = query->locale;
+          Locale* locale = locales->locales[query->locale];
+          if(locale->loaded) {
+            locale->runner->run(query, result, cancelled);
+          } else {
+            locales->search_partial(query, result, cancelled);
+          }
+        },
+        [this]() { Fl::awake(on_search_done, this); });
 
       window->end();
       window->resizable(this->word_table);
     }
 
     int run() {
+      // Enables Fl::awake from the search and loader threads
+      Fl::lock();
       this->window->show();
+      // Up before the dictionary is, its words fill in as they're parsed
+      hold_words(0);
+      locales->request(0, profile);
+      on_locale_progress();
       return Fl::run();
     }
 };
 
+double seconds_since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Runs all 4000 queries through every engine, reporting any that disagree
+// with the regex reference and the total time each engine took. dict_file
+// as for --batch, empty for the built-in dictionary.
+int compare_engines(const string& dict_file) {
+  PhonemePatternSettings settings;
+  DigitPatternCompiler compiler(&settings);
+  WordIndex word_index(&settings);
+  PhonemeMatcher phoneme_matcher(&settings);
+  WordContainer word_container;
+  BatchOptions batch_options;
+  batch_options.dict_file = dict_file;
+  if(!load_batch_dictionary(&batch_options, &word_container, &phoneme_matcher)) { return 1; }
+
+  // Rebuilt rather than using the compiled tables, to check the builders
+  auto start = chrono::steady_clock::now();
+  word_index.build(&word_container.words);
+  double index_build = seconds_since(start);
+  start = chrono::steady_clock::now();
+  phoneme_matcher.tokenize(&word_container.words);
+  double tokenize = seconds_since(start);
+
+  double regex_time = 0, dfa_time = 0, index_time = 0;
+  uint mismatches = 0;
+  vector<uint> dfa_matches;
+  vector<uint> index_matches;
+  for(PhonemeTripleMode mode : {CCC, CVC}) {
+    for(bool strict : {false, true}) {
+      settings.triple_mode = mode;
+      settings.strict_mode = strict;
+      for(uint code=0; code<NUM_CODES; code++) {
+        uint8_t digit1 = code/100, digit2 = code/10%10, digit3 = code%10;
+
+        start = chrono::steady_clock::now();
+        string pattern_str = compiler.compile_pattern(digit1, digit2, digit3);
+        regex pattern(pattern_str, regex::extended);
+        word_container.set_filter(&pattern);
+        regex_time += seconds_since(start);
+
+        start = chrono::steady_clock::now();
+        PhonemeDfa dfa = phoneme_matcher.compile(digit1, digit2, digit3);
+        phoneme_matcher.filter(&dfa, &dfa_matches);
+        dfa_time += seconds_since(start);
+
+        start = chrono::steady_clock::now();
+        WordBucket bucket = word_index.get_bucket(mode, strict, code);
+        index_matches.assign(bucket.begin(), bucket.end());
+        index_time += seconds_since(start);
+
+        if(dfa_matches != word_container.match_indexes || index_matches != word_container.match_indexes) {
+          cout << "Mismatch for " << (mode == CCC ? "CCC " : "CVC ") << (strict ? "strict " : "")
+               << code << ": regex " << word_container.match_indexes.size()
+               << ", dfa " << dfa_matches.size() << ", index " << index_matches.size() << endl;
+          mismatches++;
+        }
+      }
+    }
+  }
+
+  cout << "Index build " << index_build*1000 << "ms, tokenize " << tokenize*1000 << "ms" << endl;
+  cout << "4000 queries: regex " << regex_time << "s, dfa " << dfa_time
+       << "s, index " << index_time << "s" << endl;
+  cout << mismatches << " mismatches" << endl;
+  return mismatches == 0 ? 0 : 1;
+}
+
+#ifdef CHECK_ALLOCATIONS
+// Every query through the search thread as the GUI runs it, twice. The
+// first pass fills the buffers and the query cache, the second must not
+// allocate at all. Results are checked against the index.
+int check_allocations(MatchEngine engine, uint num_threads, bool compact_words) {
+  PhonemePatternSettings settings;
+  PhonemePatternSettings search_settings;
+  WordContainer word_container;
+  PhonemeMatcher phoneme_matcher(&search_settings);
+  load_builtin_dictionary(&word_container, &phoneme_matcher);
+  WordIndex word_index(&search_settings);
+  load_builtin_index(&word_index, &search_settings, &word_container.words);
+  WorkerPool pool(num_threads);
+  QueryCache query_cache(QUERY_CACHE_BYTES);
+  BytePrefilter prefilter;
+  if(!compact_words) { prefilter.build(&word_container.words); }
+  WordRanker ranker;
+  ranker.build(&search_settings, &word_container.words);
+  if(compact_words) { word_container.compact_words(); }
+  QueryRunner runner(engine, &search_settings, &word_container, &word_index, &phoneme_matcher, &pool,
+                     &query_cache, &prefilter, &ranker);
+
+  mutex lock;
+  condition_variable done;
+  bool has_result = false;
+  AsyncSearch search(
+    [&](const SearchQuery* query, SearchResult* result, const atomic<bool>* cancelled) {
+      runner.run(query, result, cancelled);
+    },
+    [&]() {
+      lock_guard<mutex> guard(lock);
+      has_result = true;
+      done.notify_all();
+    });
+
+  SearchResult displayed;
+  // Results come back ranked, sorted again to compare
+  vector<uint> sorted;
+  sorted.reserve(word_container.size());
+  uint mismatches = 0;
+  uint64_t allocations[2];
+  for(uint pass=0; pass<2; pass++) {
+    uint64_t start = allocation_count;
+    for(PhonemeTripleMode mode : {CCC, CVC}) {
+      for(bool strict : {false, true}) {
+        settings.triple_mode = mode;
+        settings.strict_mode = strict;
+        for(uint code=0; code<NUM_CODES; code++) {
+          SearchQuery query;
+          query.digit1 = code/100;
+          query.digit2 = code/10%10;
+          query.digit3 = code%10;
+          query.triple_mode = settings.triple_mode;
+          query.strict_mode = settings.strict_mode;
+          search.submit(query);
+          unique_lock<mutex> guard(lock);
+          done.wait(guard, [&]{ return has_result; });
+          has_result = false;
+          guard.unlock();
+          search.take_result(&displayed);
+          word_container.match_indexes.swap(displayed.match_indexes);
+          sorted.assign(word_container.match_indexes.begin(),
+                        word_container.match_indexes.begin() + displayed.exact_count);
+          sort(sorted.begin(), sorted.end());
+          WordBucket bucket = word_index.get_bucket(mode, strict, code);
+          if(!equal(bucket.begin(), bucket.end(), sorted.begin(), sorted.end())) {
+            mismatches++;
+          }
+        }
+      }
+    }
+    allocations[pass] = allocation_count - start;
+  }
+
+  cout << "4000 queries: " << allocations[0] << " allocations first, "
+       << allocations[1] << " after" << endl;
+  cout << mismatches << " mismatches" << endl;
+  return allocations[1] == 0 && mismatches == 0 ? 0 : 1;
+}
+#else
+int check_allocations(MatchEngine, uint, bool) {
+  cout << "Allocations are only counted by major_check, built alongside MajorHelper" << endl;
+  return 1;
+}
+#endif
+
+// Time per full-dictionary filter for 1..max_threads threads, for both the
+// regex and DFA engines, over a spread of codes in CCC mode.
+int speedup_curve(uint max_threads, const string& dict_file) {
+  PhonemePatternSettings settings;
+  settings.triple_mode = CCC;
+  DigitPatternCompiler compiler(&settings);
+  PhonemeMatcher phoneme_matcher(&settings);
+  WordContainer word_container;
+  BatchOptions batch_options;
+  batch_options.dict_file = dict_file;
+  if(!load_batch_dictionary(&batch_options, &word_container, &phoneme_matcher)) { return 1; }
+
+  const uint codes[] = {0, 123, 271, 456, 500, 618, 777, 804, 932, 999};
+  vector<regex> patterns;
+  vector<PhonemeDfa> dfas;
+  for(uint code : codes) {
+    patterns.push_back(regex(compiler.compile_pattern(code/100, code/10%10, code%10), regex::extended));
+    dfas.push_back(phoneme_matcher.compile(code/100, code/10%10, code%10));
+  }
+
+  cout << "threads\tregex_ms\tregex_speedup\tdfa_ms\tdfa_speedup" << endl;
+  double regex_base = 0, dfa_base = 0;
+  vector<uint> matches;
+  for(uint threads=1; threads<=max_threads; threads++) {
+    WorkerPool pool(threads);
+    auto start = chrono::steady_clock::now();
+    for(const regex& pattern : patterns) {
+      word_container.set_filter(&pattern, &pool);
+    }
+    double regex_ms = seconds_since(start)*1000 / patterns.size();
+
+    const uint dfa_rounds = 20;
+    start = chrono::steady_clock::now();
+    for(uint round=0; round<dfa_rounds; round++) {
+      for(const PhonemeDfa& dfa : dfas) {
+        phoneme_matcher.filter(&dfa, &matches, &pool);
+      }
+    }
+    double dfa_ms = seconds_since(start)*1000 / (dfas.size()*dfa_rounds);
+
+    if(threads == 1) {
+      regex_base = regex_ms;
+      dfa_base = dfa_ms;
+    }
+    cout << threads << "\t" << regex_ms << "\t" << regex_base/regex_ms
+         << "\t" << dfa_ms << "\t" << dfa_base/dfa_ms << endl;
+  }
+  return 0;
+}
+
 int main(int argc, char **argv) {
-  MainGui *main_gui = new MainGui();
-  return main_gui->run();
+  MatchEngine engine = INDEX_ENGINE;
+  uint num_threads = 0;
+  string dict_file;
+  string freq_file;
+  uint near_misses = 1;
+  string profiles_file;
+  string profile_name;
+  vector<pair<string, string>> more_locales;
+  string trace_file;
+  bool compact_words = false;
+  bool curve = false;
+  bool engine_comparison = false;
+  bool allocation_check = false;
+  bool serve = false;
+  ServerOptions server_options;
+  bool batch = false;
+  BatchOptions batch_options;
+  for(int i=1; i<argc; i++) {
+    if(strcmp(argv[i], "--compare-engines") == 0) {
+      engine_comparison = true;
+    } else if(strcmp(argv[i], "--check-allocations") == 0) {
+      allocation_check = true;
+    } else if(strcmp(argv[i], "--speedup-curve") == 0) {
+      curve = true;
+    } else if(strncmp(argv[i], "--threads=", 10) == 0) {
+      num_threads = atoi(argv[i] + 10);
+    } else if(strncmp(argv[i], "--dict=", 7) == 0) {
+      dict_file = argv[i] + 7;
+    } else if(strncmp(argv[i], "--freq=", 7) == 0) {
+      freq_file = argv[i] + 7;
+    } else if(strncmp(argv[i], "--near-misses=", 14) == 0) {
+      near_misses = atoi(argv[i] + 14);
+    } else if(strncmp(argv[i], "--profiles=", 11) == 0) {
+      profiles_file = argv[i] + 11;
+    } else if(strncmp(argv[i], "--profile=", 10) == 0) {
+      profile_name = argv[i] + 10;
+    } else if(strcmp(argv[i], "--compact-words") == 0) {
+      compact_words = true;
+    } else if(strncmp(argv[i], "--trace=", 8) == 0) {
+      trace_file = argv[i] + 8;
+    } else if(strncmp(argv[i], "--locale=", 9) == 0 && strchr(argv[i] + 9, '=') != nullptr) {
+      const char* equals = strchr(argv[i] + 9, '=');
+      more_locales.push_back(make_pair(string((const char*)argv[i] + 9, equals), string(equals + 1)));
+    } else if(strcmp(argv[i], "--batch") == 0 || strcmp(argv[i], "--batch=csv") == 0) {
+      batch = true;
+      batch_options.format = CSV_FORMAT;
+    } else if(strcmp(argv[i], "--batch=jsonl") == 0) {
+      batch = true;
+      batch_options.format = JSONL_FORMAT;
+    } else if(strncmp(argv[i], "--split=", 8) == 0) {
+      batch = true;
+      batch_options.long_number = argv[i] + 8;
+      if(!regex_match(batch_options.long_number, regex("[0-9]+", regex::extended))) {
+        cout << "--split takes digits only" << endl;
+        return 1;
+      }
+    } else if(strncmp(argv[i], "--lookup=", 9) == 0) {
+      batch = true;
+      batch_options.lookup = true;
+      batch_options.lookup_prefix = argv[i] + 9;
+      transform(batch_options.lookup_prefix.begin(), batch_options.lookup_prefix.end(),
+                batch_options.lookup_prefix.begin(), ::tolower);
+    } else if(strcmp(argv[i], "--serve") == 0) {
+      serve = true;
+    } else if(strncmp(argv[i], "--serve=", 8) == 0) {
+      serve = true;
+      server_options.socket_path = argv[i] + 8;
+    } else if(strncmp(argv[i], "--output=", 9) == 0) {
+      batch_options.output_file = argv[i] + 9;
+    } else if(strcmp(argv[i], "--strict") == 0) {
+      batch_options.strict_mode = true;
+    } else if(strcmp(argv[i], "--engine=regex") == 0) {
+      engine = REGEX_ENGINE;
+    } else if(strcmp(argv[i], "--engine=dfa") == 0) {
+      engine = DFA_ENGINE;
+    } else if(strcmp(argv[i], "--engine=index") == 0) {
+      engine = INDEX_ENGINE;
+    } else {
+      cout << "Usage: " << argv[0] << " [--engine=index|dfa|regex] [--threads=N] [--dict=FILE] [--freq=FILE]"
+           << " [--near-misses=K] [--profiles=FILE] [--profile=NAME] [--locale=NAME=FILE ...]"
+           << " [--trace=FILE] [--compact-words] [--check-allocations]" << endl;
+      cout << "       " << argv[0] << " --compare-engines|--speedup-curve [--threads=N] [--dict=FILE]" << endl;
+      cout << "       " << argv[0] << " --batch[=csv|jsonl] [--strict] [--output=FILE] [--threads=N] [--dict=FILE]"
+           << " [--profiles=FILE --profile=NAME]" << endl;
+      cout << "       " << argv[0] << " --split=DIGITS [--batch=csv|jsonl] [--output=FILE] [--dict=FILE]" << endl;
+      cout << "       " << argv[0] << " --lookup=WORD [--batch=csv|jsonl] [--output=FILE] [--dict=FILE]" << endl;
+      cout << "       " << argv[0] << " --serve[=SOCKET] [--dict=FILE] [--freq=FILE] [--profiles=FILE --profile=NAME]" << endl;
+      return 1;
+    }
+  }
+  PhonemePatternSettings defaults;
+  vector<MappingProfile> profiles(1, current_profile(&defaults, "default"));
+  if(!profiles_file.empty() && !load_profiles(profiles_file, &profiles)) {
+    return 1;
+  }
+  uint profile = 0;
+  while(profile < profiles.size() && !profile_name.empty() && profiles[profile].name != profile_name) {
+    profile++;
+  }
+  if(profile == profiles.size()) {
+    cout << "No profile named " << profile_name << endl;
+    return 1;
+  }
+  if(serve) {
+    server_options.dict_file = dict_file;
+    server_options.freq_file = freq_file;
+    server_options.profile = &profiles[profile];
+    return run_server(&server_options);
+  }
+  if(batch) {
+    batch_options.dict_file = dict_file;
+    batch_options.num_threads = num_threads;
+    batch_options.profile = &profiles[profile];
+    return run_batch(&batch_options);
+  }
+  if(engine_comparison) {
+    return compare_engines(dict_file);
+  }
+  if(allocation_check) {
+    return check_allocations(engine, num_threads, compact_words);
+  }
+  if(curve) {
+    return speedup_curve(num_threads != 0 ? num_threads : max(1u, thread::hardware_concurrency()), dict_file);
+  }
+  // Spans for the whole session, written out as Chrome trace JSON on exit
+  if(!trace_file.empty()) {
+    tracer.enable();
+  }
+  MainGui *main_gui = new MainGui(engine, num_threads, dict_file, &more_locales, freq_file, near_misses, &profiles,
+                                   profile, compact_words);
+  int status = main_gui->run();
+  if(!trace_file.empty() && !tracer.write_chrome_trace(trace_file)) {
+    cout << "Could not write " << trace_file << endl;
+  }
+  return status;
 }
 
 // TODO: Create digit -> regex compiler
@@ -0,0 +1,163 @@
+// Load generator for MajorHelper --serve=SOCKET: keeps a window of queries
+// in flight on each connection, cycling through every number, mode and
+// strictness, and prints one JSON line with the throughput and latencies.
+//
+// Usage: major_load --socket=PATH [--queries=N] [--connections=N] [--window=N]
+//                   [--limit=N]
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using namespace std;
+
+struct LoadOptions {
+  string socket_path;
+  uint queries = 100000;
+  uint connections = 1;
+  // Queries sent ahead of their responses on each connection
+  uint window = 64;
+  uint limit = 20;
+};
+
+struct ConnectionStats {
+  vector<double> latencies; // microseconds
+  uint errors = 0;
+  bool failed = false;
+};
+
+int connect_socket(const string& path) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+    if(fd >= 0) { close(fd); }
+    return -1;
+  }
+  return fd;
+}
+
+void run_connection(const LoadOptions* options, uint first_query, uint num_queries, ConnectionStats* stats) {
+  int fd = connect_socket(options->socket_path);
+  if(fd < 0) {
+    stats->failed = true;
+    return;
+  }
+  vector<chrono::steady_clock::time_point> sent_at(num_queries);
+  stats->latencies.reserve(num_queries);
+  uint sent = 0, received = 0;
+  bool line_start = true;
+  string batch;
+  char buffer[64 << 10];
+  while(received < num_queries) {
+    batch.clear();
+    auto now = chrono::steady_clock::now();
+    for(; sent < num_queries && sent - received < options->window; sent++) {
+      uint query = first_query + sent;
+      char line[64];
+      snprintf(line, sizeof(line), "%03u %s %s %u\n", query % 1000, query/1000 % 2 ? "ccc" : "cvc",
+               query/2000 % 2 ? "strict" : "loose", options->limit);
+      batch.append(line);
+      sent_at[sent] = now;
+    }
+    for(size_t done=0; done<batch.size();) {
+      ssize_t written = write(fd, batch.data() + done, batch.size() - done);
+      if(written <= 0) {
+        stats->failed = true;
+        close(fd);
+        return;
+      }
+      done += written;
+    }
+    ssize_t got = read(fd, buffer, sizeof(buffer));
+    if(got <= 0) {
+      stats->failed = true;
+      break;
+    }
+    now = chrono::steady_clock::now();
+    for(ssize_t i=0; i<got; i++) {
+      if(line_start && buffer[i] == 'e') { stats->errors++; }
+      line_start = buffer[i] == '\n';
+      if(line_start) {
+        stats->latencies.push_back(chrono::duration<double, micro>(now - sent_at[received]).count());
+        received++;
+      }
+    }
+  }
+  close(fd);
+}
+
+double percentile(const vector<double>* sorted, double p) {
+  if(sorted->empty()) { return 0; }
+  size_t rank = (size_t)(p/100 * sorted->size() + 0.5);
+  rank = min(max(rank, (size_t)1), sorted->size());
+  return (*sorted)[rank-1];
+}
+
+int main(int argc, char **argv) {
+  LoadOptions options;
+  for(int i=1; i<argc; i++) {
+    if(strncmp(argv[i], "--socket=", 9) == 0) {
+      options.socket_path = argv[i] + 9;
+    } else if(strncmp(argv[i], "--queries=", 10) == 0) {
+      options.queries = max(1, atoi(argv[i] + 10));
+    } else if(strncmp(argv[i], "--connections=", 14) == 0) {
+      options.connections = max(1, atoi(argv[i] + 14));
+    } else if(strncmp(argv[i], "--window=", 9) == 0) {
+      options.window = max(1, atoi(argv[i] + 9));
+    } else if(strncmp(argv[i], "--limit=", 8) == 0) {
+      options.limit = atoi(argv[i] + 8);
+    } else {
+      options.socket_path.clear();
+      break;
+    }
+  }
+  if(options.socket_path.empty()) {
+    cout << "Usage: " << argv[0] << " --socket=PATH [--queries=N] [--connections=N] [--window=N]"
+         << " [--limit=N]" << endl;
+    return 1;
+  }
+
+  vector<ConnectionStats> stats(options.connections);
+  vector<thread> threads;
+  uint per_connection = options.queries / options.connections;
+  auto start = chrono::steady_clock::now();
+  for(uint i=0; i<options.connections; i++) {
+    uint count = i+1 < options.connections ? per_connection : options.queries - i*per_connection;
+    threads.emplace_back(run_connection, &options, i*per_connection, count, &stats[i]);
+  }
+  for(thread& t : threads) {
+    t.join();
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  vector<double> latencies;
+  uint errors = 0;
+  bool failed = false;
+  for(const ConnectionStats& connection : stats) {
+    latencies.insert(latencies.end(), connection.latencies.begin(), connection.latencies.end());
+    errors += connection.errors;
+    failed = failed || connection.failed;
+  }
+  sort(latencies.begin(), latencies.end());
+  printf("{\"load\":\"major_load\",\"connections\":%u,\"window\":%u,\"limit\":%u,\"queries\":%zu,"
+         "\"seconds\":%.3f,\"per_second\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,"
+         "\"max_us\":%.1f,\"errors\":%u,\"failed\":%s}\n",
+         options.connections, options.window, options.limit, latencies.size(), seconds,
+         latencies.size() / seconds, percentile(&latencies, 50), percentile(&latencies, 90),
+         percentile(&latencies, 99), percentile(&latencies, 100), errors, failed ? "true" : "false");
+  return failed || errors > 0 ? 1 : 0;
+}
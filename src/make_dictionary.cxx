@@ -0,0 +1,105 @@
+// Build-time tool: turns an ipa-dict text file into a header of static
+// tables (word arena, tokenized IPA and per-code index buckets) so the app
+// starts without parsing anything. Run by CMake, see CMakeLists.txt.
+//
+// Usage: make_dictionary <ipa-dict.txt> <output.h>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "phoneme_matcher.h"
+#include "phonetics.h"
+#include "word_index.h"
+
+
+using namespace std;
+
+// As a C++ string literal, \0 and all
+void write_literal(FILE* out, string_view s) {
+  fputc('"', out);
+  for(char c : s) {
+    switch(c) {
+      case '"': fputs("\\\"", out); break;
+      case '\\': fputs("\\\\", out); break;
+      case '?': fputs("\\?", out); break;
+      case '\0': fputs("\\0", out); break;
+      case '\n': fputs("\\n", out); break;
+      case '\t': fputs("\\t", out); break;
+      default: fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+template<typename T>
+void write_array(FILE* out, const char* type, const char* name, const T* data, size_t size) {
+  fprintf(out, "  constexpr %s %s[] = {", type, name);
+  for(size_t i=0; i<size; i++) {
+    fputs(i % 20 == 0 ? "\n    " : " ", out);
+    fprintf(out, "%u,", (uint)data[i]);
+  }
+  fprintf(out, "\n  };\n");
+}
+
+int main(int argc, char **argv) {
+  if(argc != 3) {
+    cout << "Usage: " << argv[0] << " <ipa-dict.txt> <output.h>" << endl;
+    return 1;
+  }
+  WordContainer word_container{string(argv[1])};
+  if(word_container.words.empty()) { return 1; }
+  PhonemePatternSettings settings;
+  PhonemeMatcher matcher(&settings);
+  matcher.tokenize(&word_container.words);
+  WordIndex word_index(&settings);
+  word_index.build(&word_container.words);
+
+  FILE* out = fopen(argv[2], "w");
+  if(out == nullptr) {
+    cout << "Could not write " << argv[2] << endl;
+    return 1;
+  }
+  uint num_words = word_container.words.size();
+  fprintf(out, "// Generated by make_dictionary from %s, do not edit.\n", argv[1]);
+  fprintf(out, "#pragma once\n\n#include <cstdint>\n\nnamespace compiled_dictionary {\n");
+  fprintf(out, "  const unsigned int num_words = %u;\n\n", num_words);
+
+  // Same layout WordContainer::load builds: word\0ipa\0 per word
+  const char* arena = word_container.arena.data();
+  vector<uint> word_offsets;
+  fprintf(out, "  constexpr char arena[] =");
+  for(const DictionaryWord& word : word_container.words) {
+    word_offsets.push_back(word.word.data() - arena);
+    word_offsets.push_back(word.ipa.data() - arena);
+    fputs("\n    ", out);
+    write_literal(out, string_view(word.word.data(), word.word.size()+1));
+    fputc(' ', out);
+    write_literal(out, string_view(word.ipa.data(), word.ipa.size()+1));
+  }
+  word_offsets.push_back(word_container.arena.size());
+  fprintf(out, ";\n");
+  write_array(out, "unsigned int", "word_offsets", word_offsets.data(), word_offsets.size());
+
+  write_array(out, "uint8_t", "tokens", matcher.token_data, matcher.offset_data[num_words]);
+  write_array(out, "unsigned int", "token_offsets", matcher.offset_data, num_words+1);
+  fprintf(out, "  const unsigned int num_symbols = %zu;\n", matcher.symbols->symbols.size());
+  fprintf(out, "  const char* const symbols[] = {");
+  for(const string& symbol : matcher.symbols->symbols) {
+    write_literal(out, symbol);
+    fputs(", ", out);
+  }
+  fprintf(out, "};\n");
+
+  fprintf(out, "  const char settings_fingerprint[] = ");
+  write_literal(out, settings_fingerprint(&settings));
+  fprintf(out, ";\n");
+  write_array(out, "unsigned int", "bucket_words", word_index.bucket_data, word_index.bucket_offset_data[NUM_BUCKETS]);
+  write_array(out, "unsigned int", "bucket_offsets", word_index.bucket_offset_data, NUM_BUCKETS+1);
+  fprintf(out, "}\n");
+
+  if(fclose(out) != 0) { return 1; }
+  cout << "Compiled " << num_words << " words into " << argv[2] << endl;
+  return 0;
+}
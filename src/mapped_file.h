@@ -0,0 +1,56 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+
+using namespace std;
+
+// Read-only mmap of a whole file, unmapped on destruction
+class MappedFile {
+  public:
+    const char* data = nullptr;
+    size_t size = 0;
+    // Nanoseconds, whole seconds miss an edit made in the same second
+    int64_t mtime_ns = 0;
+
+    MappedFile() { }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+      close();
+    }
+
+    bool open(const string& file_name) {
+      close();
+      int fd = ::open(file_name.c_str(), O_RDONLY);
+      if(fd < 0) { return false; }
+      struct stat info;
+      if(fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        return false;
+      }
+      void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if(mapped == MAP_FAILED) { return false; }
+      data = (const char*)mapped;
+      size = info.st_size;
+      mtime_ns = int64_t(info.st_mtim.tv_sec)*1000000000 + info.st_mtim.tv_nsec;
+      return true;
+    }
+
+    void close() {
+      if(data != nullptr) {
+        munmap((void*)data, size);
+      }
+      data = nullptr;
+      size = 0;
+      mtime_ns = 0;
+    }
+};
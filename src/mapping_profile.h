@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "phonetics.h"
+
+
+using namespace std;
+
+// One Major system's digit mappings, e.g. 6=ch/sh/j with 7=k/g against
+// 6=sh/j with 7=k/g/ch
+struct MappingProfile {
+  string name;
+  vector<string> consonants[10];
+  vector<string> vowels[10];
+  vector<string> silent;
+};
+
+// Which parts of the mappings differ between two profiles
+struct DigitChange {
+  bool consonant[10] = {false};
+  bool vowel[10] = {false};
+  bool silent = false;
+  // Phonemes that joined or left a digit (or the silent set), a word
+  // without any of them keeps its codes
+  vector<string> phonemes;
+
+  bool any() const {
+    if(silent) { return true; }
+    for(uint d=0; d<10; d++) {
+      if(consonant[d] || vowel[d]) { return true; }
+    }
+    return false;
+  }
+
+  void add_moved(const vector<string>* from, const vector<string>* to) {
+    for(const string& phoneme : *from) {
+      if(find(to->begin(), to->end(), phoneme) == to->end()) { phonemes.push_back(phoneme); }
+    }
+  }
+
+  // Whether results for this number may differ
+  bool affects(PhonemeTripleMode mode, uint code) const {
+    uint d1 = code/100, d2 = code/10%10, d3 = code%10;
+    return consonant[d1] || consonant[d3] || (mode == CCC ? consonant[d2] : vowel[d2]);
+  }
+
+  bool touches(string_view ipa) const {
+    for(const string& phoneme : phonemes) {
+      if(ipa.find(phoneme) != string_view::npos) { return true; }
+    }
+    return false;
+  }
+};
+
+MappingProfile current_profile(PhonemePatternSettings* settings, string name) {
+  MappingProfile profile;
+  profile.name = name;
+  for(uint8_t d=0; d<10; d++) {
+    profile.consonants[d] = settings->get_consonants(d);
+    profile.vowels[d] = settings->get_vowels(d);
+  }
+  profile.silent = settings->silent_c;
+  return profile;
+}
+
+DigitChange digit_change(PhonemePatternSettings* settings, const MappingProfile* profile) {
+  DigitChange change;
+  for(uint8_t d=0; d<10; d++) {
+    const vector<string>* sets[2][2] = {{&settings->get_consonants(d), &profile->consonants[d]},
+                                        {&settings->get_vowels(d), &profile->vowels[d]}};
+    for(uint kind=0; kind<2; kind++) {
+      if(*sets[kind][0] == *sets[kind][1]) { continue; }
+      (kind == 0 ? change.consonant : change.vowel)[d] = true;
+      change.add_moved(sets[kind][0], sets[kind][1]);
+      change.add_moved(sets[kind][1], sets[kind][0]);
+    }
+  }
+  change.silent = settings->silent_c != profile->silent;
+  change.add_moved(&settings->silent_c, &profile->silent);
+  change.add_moved(&profile->silent, &settings->silent_c);
+  return change;
+}
+
+void apply_profile(const MappingProfile* profile, PhonemePatternSettings* settings) {
+  for(uint8_t d=0; d<10; d++) {
+    settings->set_consonants(d, &profile->consonants[d]);
+    settings->set_vowels(d, &profile->vowels[d]);
+  }
+  settings->silent_c = profile->silent;
+}
+
+// Profiles from a file like
+//
+//   [classic]
+//   6 = tʃ ʃ dʒ ʒ
+//   7 = k ɡ kw
+//   [ch-hard]
+//   6 = ʃ dʒ ʒ
+//   7 = k ɡ kw tʃ
+//   0v = uː ʊ
+//   silent = h w
+//
+// Digits are consonants, with a v the CVC vowels. Anything a profile
+// doesn't list keeps the built-in mapping. The built-in mappings are
+// always first, as "default".
+bool load_profiles(string file_name, vector<MappingProfile>* out) {
+  PhonemePatternSettings defaults;
+  out->assign(1, current_profile(&defaults, "default"));
+  ifstream file(file_name);
+  if(!file) {
+    cout << "Could not open file " << file_name << endl;
+    return false;
+  }
+  string line;
+  uint line_number = 0;
+  while(getline(file, line)) {
+    line_number++;
+    size_t comment = line.find('#');
+    if(comment != string::npos) { line.erase(comment); }
+    size_t equals_at = line.find('=');
+    if(equals_at != string::npos) { line.replace(equals_at, 1, " = "); }
+    istringstream fields(line);
+    string key, equals, phoneme;
+    if(!(fields >> key)) { continue; }
+    if(key.front() == '[' && key.back() == ']') {
+      out->push_back(current_profile(&defaults, key.substr(1, key.size()-2)));
+      continue;
+    }
+    bool vowel = key.size() == 2 && key[1] == 'v';
+    bool digit = (key.size() == 1 || vowel) && key[0] >= '0' && key[0] <= '9';
+    if(out->size() == 1 || !(fields >> equals) || equals != "=" || (!digit && key != "silent")) {
+      cout << file_name << ":" << line_number << ": expected [name], DIGIT = ..., DIGITv = ... or silent = ..." << endl;
+      return false;
+    }
+    vector<string>* phonemes = key == "silent" ? &out->back().silent
+      : vowel ? &out->back().vowels[key[0]-'0'] : &out->back().consonants[key[0]-'0'];
+    phonemes->clear();
+    while(fields >> phoneme) {
+      phonemes->push_back(phoneme);
+    }
+    // An empty group would match nothing in the index but anything in the regex
+    if(phonemes->empty() && key != "silent") {
+      cout << file_name << ":" << line_number << ": " << key << " needs at least one phoneme" << endl;
+      return false;
+    }
+  }
+  return true;
+}
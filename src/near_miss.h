@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapping_profile.h"
+#include "phonetics.h"
+#include "word_coder.h"
+
+
+using namespace std;
+
+// A word a few edits away from the digits asked for
+struct NearMiss {
+  uint word;
+  uint distance;
+};
+
+// Edit distance, in phonemes, between a digit triple and every word. Each
+// word is reduced once to its sequence of phoneme classes (see WordCoder),
+// consonants only for CCC and with vowels for CVC. The triple becomes a
+// three class pattern, with a class set per digit, and is run against each
+// word with the Myers/Hyyrö bit-vector recurrence, one step per phoneme.
+class NearMissSearch {
+  private:
+    const vector<DictionaryWord>* words = nullptr;
+    PhonemePatternSettings* settings;
+    WordCoder coder;
+    // [mode] word i is class_data[class_offsets[i]..class_offsets[i+1])
+    vector<uint8_t> class_data[2];
+    vector<uint> class_offsets[2];
+    vector<uint8_t> group_classes;
+
+    // Bit i of peq[c] is set if pattern position i takes class c
+    void add_group(const vector<string>* phonemes, uint position, uint64_t* peq) {
+      for(const string& phoneme : *phonemes) {
+        group_classes.clear();
+        coder.phoneme_classes(phoneme, true, &group_classes);
+        if(group_classes.size() == 1) { peq[group_classes[0]] |= uint64_t(1) << position; }
+      }
+    }
+
+  public:
+    NearMissSearch(PhonemePatternSettings* settings) {
+      this->settings = settings;
+    }
+
+    void build(const vector<DictionaryWord>* words) {
+      this->words = words;
+      coder.setup(settings);
+      for(PhonemeTripleMode mode : {CCC, CVC}) {
+        class_data[mode].clear();
+        class_offsets[mode].assign(1, 0);
+        for(const DictionaryWord& word : *words) {
+          coder.phoneme_classes(word.ipa, mode == CVC, &class_data[mode]);
+          class_offsets[mode].push_back(class_data[mode].size());
+        }
+      }
+      group_classes.reserve(8);
+    }
+
+    bool built() {
+      return words != nullptr;
+    }
+
+    // After the settings' digits changed, rewrites the classes of the words
+    // holding a moved phoneme in place. If a word's phonemes now split up
+    // differently, or a silent one appears or disappears, its length
+    // changes and everything is built again.
+    void update(const DigitChange* change) {
+      coder.setup(settings);
+      for(PhonemeTripleMode mode : {CCC, CVC}) {
+        for(uint i=0; i<words->size(); i++) {
+          string_view ipa = (*words)[i].ipa;
+          if(!change->touches(ipa)) { continue; }
+          group_classes.clear();
+          coder.phoneme_classes(ipa, mode == CVC, &group_classes);
+          uint offset = class_offsets[mode][i];
+          if(group_classes.size() != class_offsets[mode][i+1] - offset) {
+            build(words);
+            return;
+          }
+          copy(group_classes.begin(), group_classes.end(), class_data[mode].begin() + offset);
+        }
+      }
+    }
+
+    // Distance from the pattern to all of text in the return value, and to
+    // its nearest prefix in *prefix_distance. The pattern's bits are the
+    // rows, each text class moves one column along, and the top row grows
+    // by one per column since the whole text has to be accounted for.
+    static uint edit_distance(const uint64_t* peq, uint pattern_size, const uint8_t* text, uint text_size,
+                              uint* prefix_distance) {
+      uint64_t vp = pattern_size == 64 ? ~uint64_t(0) : (uint64_t(1) << pattern_size) - 1;
+      uint64_t vn = 0;
+      uint64_t last = uint64_t(1) << (pattern_size-1);
+      uint score = pattern_size;
+      uint best = score;
+      for(uint j=0; j<text_size; j++) {
+        uint64_t eq = peq[text[j]];
+        uint64_t xv = eq | vn;
+        uint64_t xh = (((eq & vp) + vp) ^ vp) | eq;
+        uint64_t hp = vn | ~(xh | vp);
+        uint64_t hn = vp & xh;
+        if(hp & last) {
+          score++;
+        } else if(hn & last) {
+          score--;
+        }
+        hp = (hp << 1) | 1;
+        hn <<= 1;
+        vp = hn | ~(xv | hp);
+        vn = hp & xv;
+        best = min(best, score);
+      }
+      *prefix_distance = best;
+      return score;
+    }
+
+    // Words within max_distance edits of the triple, in dictionary order.
+    // Strict compares whole words, otherwise the word only has to start
+    // with something close. out should have room for every word.
+    uint search(uint8_t digit1, uint8_t digit2, uint8_t digit3, uint max_distance, vector<NearMiss>* out) {
+      out->clear();
+      PhonemeTripleMode mode = settings->triple_mode;
+      uint64_t peq[NUM_PHONEME_CLASSES] = {0};
+      add_group(&settings->get_consonants(digit1), 0, peq);
+      add_group(mode == CCC ? &settings->get_consonants(digit2) : &settings->get_vowels(digit2), 1, peq);
+      add_group(&settings->get_consonants(digit3), 2, peq);
+
+      const uint8_t* data = class_data[mode].data();
+      const uint* offsets = class_offsets[mode].data();
+      for(uint i=0; i+1<class_offsets[mode].size(); i++) {
+        uint size = offsets[i+1] - offsets[i];
+        // Too short or too long to get within max_distance of 3
+        if(size + max_distance < 3 || (settings->strict_mode && size > 3 + max_distance)) { continue; }
+        uint prefix_distance;
+        uint distance = edit_distance(peq, 3, data + offsets[i], size, &prefix_distance);
+        if(!settings->strict_mode) { distance = prefix_distance; }
+        if(distance <= max_distance) { out->push_back(NearMiss{i, distance}); }
+      }
+      return out->size();
+    }
+};
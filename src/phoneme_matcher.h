@@ -0,0 +1,439 @@
+#pragma once
+
+#include <bitset>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "phonetics.h"
+
+
+using namespace std;
+
+// How a query is answered. REGEX_ENGINE is the original std::regex path and
+// is kept as the reference the others must agree with.
+enum MatchEngine { INDEX_ENGINE, DFA_ENGINE, REGEX_ENGINE };
+
+typedef uint8_t PhonemeId;
+const PhonemeId UNKNOWN_PHONEME = 0;
+
+// Interned IPA symbols (one UTF-8 code point each). Phonemes from the tables
+// such as "tʃ" or "eɪ" are sequences of these, which keeps overlapping table
+// entries (t/tʃ, k/kw, e/eɪ) matchable exactly like the regex does.
+class PhonemeSymbols {
+  private:
+    unordered_map<string, PhonemeId> ids;
+
+    static uint utf8_length(unsigned char lead) {
+      if(lead < 0x80) { return 1; }
+      if((lead & 0xE0) == 0xC0) { return 2; }
+      if((lead & 0xF0) == 0xE0) { return 3; }
+      if((lead & 0xF8) == 0xF0) { return 4; }
+      return 1;
+    }
+
+    void intern_all(const vector<string>* phonemes) {
+      for(const string& phoneme : *phonemes) {
+        intern_all(&phoneme);
+      }
+    }
+
+    void intern_all(const string* s) {
+      for(uint pos=0; pos<s->size();) {
+        uint len = utf8_length((*s)[pos]);
+        intern(s->substr(pos, len));
+        pos += len;
+      }
+    }
+
+  public:
+    // id -> UTF-8 bytes, symbols[0] is the catch-all for a full table
+    vector<string> symbols{""};
+
+    PhonemeSymbols(PhonemePatternSettings* settings) {
+      intern_all(&VOWELS);
+      intern_all(&CONSONANTS);
+      for(uint8_t d=0; d<10; d++) {
+        vector<string> consonants = settings->get_consonants(d);
+        vector<string> vowels = settings->get_vowels(d);
+        intern_all(&consonants);
+        intern_all(&vowels);
+      }
+      string ignored = bracket_bytes(&settings->ignored);
+      string rhotic = bracket_bytes(&settings->rhotic);
+      intern_all(&ignored);
+      intern_all(&rhotic);
+    }
+
+    // Replaces the table with one saved earlier, so saved tokens keep
+    // their meaning
+    void restore(const vector<string>* saved) {
+      ids.clear();
+      symbols.assign(1, "");
+      for(uint i=1; i<saved->size(); i++) {
+        intern((*saved)[i]);
+      }
+    }
+
+    PhonemeId intern(const string& symbol) {
+      auto found = ids.find(symbol);
+      if(found != ids.end()) { return found->second; }
+      if(symbols.size() > 255) { return UNKNOWN_PHONEME; }
+      PhonemeId id = symbols.size();
+      symbols.push_back(symbol);
+      ids[symbol] = id;
+      return id;
+    }
+
+    void tokenize(string_view ipa, vector<PhonemeId>* out) {
+      for(uint pos=0; pos<ipa.size();) {
+        uint len = utf8_length(ipa[pos]);
+        out->push_back(intern(string(ipa.substr(pos, len))));
+        pos += len;
+      }
+    }
+};
+
+// DFA over PhonemeIds for one digit triple. State 0 is dead.
+class PhonemeDfa {
+  public:
+    uint num_symbols = 0;
+    uint16_t start = 0;
+    vector<uint16_t> next;      // [state * num_symbols + symbol]
+    vector<bool> accepting;
+    vector<bool> accept_rest;   // accepting whatever follows, i.e. inside `.*`
+
+    bool matches(const PhonemeId* begin, const PhonemeId* end) const {
+      uint state = start;
+      for(const PhonemeId* p=begin; p<end; p++) {
+        state = next[state*num_symbols + *p];
+        if(state == 0) { return false; }
+        if(accept_rest[state]) { return true; }
+      }
+      return accepting[state];
+    }
+};
+
+// Compiles the pattern DigitPatternCompiler::compile_pattern would emit into
+// a PhonemeDfa. The pattern is first built as a byte-level NFA (the regex
+// classes like [ˈˌ] match single bytes, and we must agree with it), then
+// determinised over the interned symbols by feeding each symbol's bytes.
+class PhonemeDfaCompiler {
+  private:
+    typedef bitset<256> ByteSet;
+    typedef vector<uint64_t> StateSet;
+    struct NfaEdge { uint to; ByteSet bytes; };
+
+    PhonemePatternSettings* settings;
+    PhonemeSymbols* symbols;
+    vector<vector<NfaEdge>> edges;
+    vector<vector<uint>> epsilons;
+    uint any_state = 0;
+
+    uint add_state() {
+      edges.emplace_back();
+      epsilons.emplace_back();
+      return edges.size()-1;
+    }
+
+    static ByteSet byte_set(const string* bytes) {
+      ByteSet set;
+      for(unsigned char c : *bytes) { set.set(c); }
+      return set;
+    }
+
+    uint add_literal(uint from, const string* literal, uint to) {
+      uint state = from;
+      for(uint i=0; i<literal->size(); i++) {
+        uint target = i == literal->size()-1 ? to : add_state();
+        ByteSet set;
+        set.set((unsigned char)(*literal)[i]);
+        edges[state].push_back(NfaEdge{target, set});
+        state = target;
+      }
+      return to;
+    }
+
+    // (a|b|c)
+    uint add_group(uint from, const vector<string>* phonemes) {
+      uint to = add_state();
+      for(const string& phoneme : *phonemes) {
+        add_literal(from, &phoneme, to);
+      }
+      return to;
+    }
+
+    // (a|b|c)*
+    uint add_group_star(uint from, const vector<string>* phonemes) {
+      uint loop = add_state();
+      epsilons[from].push_back(loop);
+      for(const string& phoneme : *phonemes) {
+        add_literal(loop, &phoneme, loop);
+      }
+      return loop;
+    }
+
+    // [...]*
+    uint add_class_star(uint from, const ByteSet* set) {
+      uint loop = add_state();
+      epsilons[from].push_back(loop);
+      edges[loop].push_back(NfaEdge{loop, *set});
+      return loop;
+    }
+
+    // [...]?
+    uint add_class_optional(uint from, const ByteSet* set) {
+      uint to = add_state();
+      epsilons[from].push_back(to);
+      edges[from].push_back(NfaEdge{to, *set});
+      return to;
+    }
+
+    // scratch for close/step
+    vector<uint> pending_states;
+    StateSet stepped;
+
+    static bool has(const StateSet* set, uint s) {
+      return ((*set)[s/64] >> (s%64)) & 1;
+    }
+
+    static void add(StateSet* set, uint s) {
+      (*set)[s/64] |= uint64_t(1) << (s%64);
+    }
+
+    void close(StateSet* set) {
+      pending_states.clear();
+      for(uint s=0; s<edges.size(); s++) {
+        if(has(set, s)) { pending_states.push_back(s); }
+      }
+      while(!pending_states.empty()) {
+        uint s = pending_states.back();
+        pending_states.pop_back();
+        for(uint to : epsilons[s]) {
+          if(!has(set, to)) {
+            add(set, to);
+            pending_states.push_back(to);
+          }
+        }
+      }
+    }
+
+    void step(StateSet* set, unsigned char byte) {
+      stepped.assign(set->size(), 0);
+      for(uint w=0; w<set->size(); w++) {
+        for(uint64_t bits=(*set)[w]; bits; bits &= bits-1) {
+          uint s = w*64 + __builtin_ctzll(bits);
+          for(const NfaEdge& edge : edges[s]) {
+            if(edge.bytes.test(byte)) { add(&stepped, edge.to); }
+          }
+        }
+      }
+      close(&stepped);
+      set->swap(stepped);
+    }
+
+  public:
+    PhonemeDfaCompiler(PhonemePatternSettings* settings, PhonemeSymbols* symbols) {
+      this->settings = settings;
+      this->symbols = symbols;
+    }
+
+    PhonemeDfa compile(uint8_t digit1, uint8_t digit2, uint8_t digit3) {
+      edges.clear();
+      epsilons.clear();
+
+      const vector<string>& phoneme1 = settings->get_consonants(digit1);
+      const vector<string>& phoneme2 = settings->triple_mode == CCC
+        ? settings->get_consonants(digit2) : settings->get_vowels(digit2);
+      const vector<string>& phoneme3 = settings->get_consonants(digit3);
+      string ignored_bytes = bracket_bytes(&settings->ignored);
+      string rhotic_bytes = bracket_bytes(&settings->rhotic);
+      ByteSet ignored = byte_set(&ignored_bytes);
+      ByteSet rhotic = byte_set(&rhotic_bytes);
+
+      // Same shape as compile_pattern
+      uint start = add_state();
+      uint s = add_group(start, &phoneme1);
+      s = add_class_star(s, &ignored);
+      if(settings->triple_mode == CCC) {
+        s = add_group_star(s, &VOWELS);
+        s = add_class_optional(s, &rhotic);
+        s = add_class_star(s, &ignored);
+      }
+      s = add_group(s, &phoneme2);
+      s = add_class_star(s, &ignored);
+      if(settings->triple_mode == CCC) {
+        s = add_group_star(s, &VOWELS);
+        s = add_class_optional(s, &rhotic);
+        s = add_class_star(s, &ignored);
+      }
+      s = add_group(s, &phoneme3);
+      uint accept = s;
+      any_state = 0;
+      if(!settings->strict_mode) {
+        ByteSet any;
+        any.set();
+        any.reset(0);
+        s = add_class_star(s, &any);
+        accept = s;
+        any_state = s;
+      }
+
+      // Subset construction, symbols are fed to the NFA as their bytes.
+      // Unknown symbols only get past `.*`, which 0xFF stands in for.
+      PhonemeDfa dfa;
+      dfa.num_symbols = symbols->symbols.size();
+      map<StateSet, uint16_t> dfa_states;
+      vector<StateSet> pending;
+      uint words = (edges.size()+63)/64;
+
+      StateSet dead(words, 0);
+      dfa_states[dead] = 0;
+      dfa.next.resize(dfa.num_symbols, 0);
+      dfa.accepting.push_back(false);
+      dfa.accept_rest.push_back(false);
+
+      StateSet initial(words, 0);
+      add(&initial, start);
+      close(&initial);
+      dfa_states[initial] = 1;
+      dfa.start = 1;
+      pending.push_back(initial);
+      dfa.next.resize(2*dfa.num_symbols, 0);
+      dfa.accepting.push_back(has(&initial, accept));
+      dfa.accept_rest.push_back(any_state != 0 && has(&initial, any_state));
+
+      while(!pending.empty()) {
+        StateSet current = pending.back();
+        pending.pop_back();
+        uint16_t from = dfa_states[current];
+        for(uint symbol=0; symbol<dfa.num_symbols; symbol++) {
+          StateSet target = current;
+          if(symbol == UNKNOWN_PHONEME) {
+            step(&target, 0xFF);
+          } else {
+            for(unsigned char byte : symbols->symbols[symbol]) {
+              step(&target, byte);
+            }
+          }
+          auto found = dfa_states.find(target);
+          uint16_t to;
+          if(found == dfa_states.end()) {
+            to = dfa_states.size();
+            dfa_states[target] = to;
+            pending.push_back(target);
+            dfa.next.resize((to+1)*dfa.num_symbols, 0);
+            dfa.accepting.push_back(has(&target, accept));
+            dfa.accept_rest.push_back(any_state != 0 && has(&target, any_state));
+          } else {
+            to = found->second;
+          }
+          dfa.next[from*dfa.num_symbols + symbol] = to;
+        }
+      }
+      return dfa;
+    }
+};
+
+// Every word's IPA tokenized once into PhonemeIds, stored back to back.
+class PhonemeMatcher {
+  private:
+    PhonemeSymbols own_symbols;
+
+  public:
+    // own_symbols, or a table shared with other dictionaries (locales.h)
+    PhonemeSymbols* symbols;
+    // Held to compile when another thread may be adding to symbols
+    mutex* symbols_lock = nullptr;
+    PhonemeDfaCompiler compiler;
+    vector<PhonemeId> tokens;
+    vector<uint> offsets;
+    // word i is token_data[offset_data[i]..offset_data[i+1]), pointing at
+    // the vectors above or into a mapped cache
+    const PhonemeId* token_data = nullptr;
+    const uint* offset_data = nullptr;
+    uint num_words = 0;
+    shared_ptr<MappedFile> mapping;
+
+    PhonemeMatcher(PhonemePatternSettings* settings) : PhonemeMatcher(settings, nullptr) { }
+
+    // nullptr for a table of its own
+    PhonemeMatcher(PhonemePatternSettings* settings, PhonemeSymbols* shared_symbols)
+      : own_symbols(settings), symbols(shared_symbols != nullptr ? shared_symbols : &own_symbols),
+        compiler(settings, symbols) { }
+
+    // symbols may point at own_symbols
+    PhonemeMatcher(const PhonemeMatcher&) = delete;
+    PhonemeMatcher& operator=(const PhonemeMatcher&) = delete;
+
+    void tokenize(const vector<DictionaryWord>* words) {
+      tokens.clear();
+      offsets.clear();
+      offsets.push_back(0);
+      for(const DictionaryWord& word : *words) {
+        symbols->tokenize(word.ipa, &tokens);
+        offsets.push_back(tokens.size());
+      }
+      mapping.reset();
+      token_data = tokens.data();
+      offset_data = offsets.data();
+      num_words = words->size();
+    }
+
+    // Tokens saved by an earlier tokenize(), see dictionary_cache.h
+    void attach(shared_ptr<MappedFile> mapping, const vector<string>* saved_symbols,
+                const PhonemeId* token_data, const uint* offset_data, uint num_words) {
+      symbols->restore(saved_symbols);
+      tokens.clear();
+      offsets.clear();
+      this->mapping = mapping;
+      this->token_data = token_data;
+      this->offset_data = offset_data;
+      this->num_words = num_words;
+    }
+
+    // Must be compiled after tokenize() so every symbol is known
+    PhonemeDfa compile(uint8_t digit1, uint8_t digit2, uint8_t digit3) {
+      if(symbols_lock == nullptr) { return compiler.compile(digit1, digit2, digit3); }
+      lock_guard<mutex> guard(*symbols_lock);
+      return compiler.compile(digit1, digit2, digit3);
+    }
+
+    uint filter(const PhonemeDfa* dfa, vector<uint>* match_indexes) {
+      match_indexes->clear();
+      for(uint i=0; i<num_words; i++) {
+        if(dfa->matches(token_data + offset_data[i], token_data + offset_data[i+1])) {
+          match_indexes->push_back(i);
+        }
+      }
+      return match_indexes->size();
+    }
+
+    // Only the given candidates, e.g. to narrow an earlier, looser result
+    uint filter(const PhonemeDfa* dfa, const vector<uint>* candidates, vector<uint>* match_indexes) {
+      match_indexes->clear();
+      for(uint i : *candidates) {
+        if(dfa->matches(token_data + offset_data[i], token_data + offset_data[i+1])) {
+          match_indexes->push_back(i);
+        }
+      }
+      return match_indexes->size();
+    }
+
+    uint filter(const PhonemeDfa* dfa, const vector<uint>* candidates, vector<uint>* match_indexes,
+                WorkerPool* pool, const atomic<bool>* cancelled = nullptr) {
+      return parallel_filter(pool, candidates, [&](uint i) {
+        return dfa->matches(token_data + offset_data[i], token_data + offset_data[i+1]);
+      }, match_indexes, cancelled);
+    }
+
+    uint filter(const PhonemeDfa* dfa, vector<uint>* match_indexes, WorkerPool* pool,
+                const atomic<bool>* cancelled = nullptr) {
+      return parallel_filter(pool, num_words, [&](uint i) {
+        return dfa->matches(token_data + offset_data[i], token_data + offset_data[i+1]);
+      }, match_indexes, cancelled);
+    }
+};
@@ -1,12 +1,23 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iterator>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <regex>
 #include <sstream>
+#include <string_view>
 #include <vector>
 
+#include "front_coded.h"
+#include "mapped_file.h"
+#include "worker_pool.h"
+
 
 using namespace std;
 
@@ -19,9 +30,11 @@ void set_digits(string* number, uint* digit1, uint* digit2, uint* digit3) {
   }
 }
 
+// Both views point into WordContainer::arena and are NUL-terminated there,
+// so data() can be handed straight to C APIs.
 struct DictionaryWord {
-  string word;
-  string ipa;
+  string_view word;
+  string_view ipa;
 };
 
 enum PhonemeTripleMode { CCC, CVC };
@@ -78,18 +91,32 @@ const vector<string> CONSONANTS{
 "l", /*Lump*/
 };
 
-string phonemes_to_group(const vector<string> *phonemes) {
-  ostringstream ss;
-  ss << "(";
+// "(a|b|c)" on the end of out
+void append_group(const vector<string> *phonemes, string* out) {
+  out->push_back('(');
   uint total_phonemes = phonemes->size();
   for(uint i=0; i<total_phonemes; i++) {
-    ss << (*phonemes)[i];
+    out->append((*phonemes)[i]);
     if(i < total_phonemes-1) {
-      ss << "|";
+      out->push_back('|');
     }
   }
-  ss << ")";
-  return ss.str();
+  out->push_back(')');
+}
+
+string phonemes_to_group(const vector<string> *phonemes) {
+  string group;
+  append_group(phonemes, &group);
+  return group;
+}
+
+// Bytes inside a "[...]" bracket expression such as settings->ignored.
+// std::regex matches those byte by byte, so we do the same.
+string bracket_bytes(const string* bracket) {
+  if(bracket->size() >= 2 && bracket->front() == '[' && bracket->back() == ']') {
+    return bracket->substr(1, bracket->size()-2);
+  }
+  return *bracket;
 }
 
 class PhonemePatternSettings {
@@ -97,27 +124,14 @@ class PhonemePatternSettings {
     PhonemeTripleMode triple_mode = CVC;
     bool strict_mode = false;
 
-    vector<string> digit0_c{"s", "z"};
-    vector<string> digit1_c{"t", "d"};
-    vector<string> digit2_c{"n"};
-    vector<string> digit3_c{"m"};
-    vector<string> digit4_c{"r", "ɹ"}; // ɹ
-    vector<string> digit5_c{"l"};
-    vector<string> digit6_c{"tʃ", "ʃ", "dʒ", "ʒ"};
-    vector<string> digit7_c{"k", "ɡ", "kw"};
-    vector<string> digit8_c{"f", "v"};
-    vector<string> digit9_c{"p", "b"};
-
-    vector<string> digit0_v{"uː"};
-    vector<string> digit1_v{"æ"};
-    vector<string> digit2_v{"e", "ɛ"};
-    vector<string> digit3_v{"ɪ"};
-    vector<string> digit4_v{"ɒ"};
-    vector<string> digit5_v{"ʊ"};
-    vector<string> digit6_v{"eɪ"};
-    vector<string> digit7_v{"iː"};
-    vector<string> digit8_v{"aɪ"};
-    vector<string> digit9_v{"əʊ"};
+    // Phonemes for each digit, consonants[d] and vowels[d] (CVC's middle)
+    vector<string> consonants[10]{{"s", "z"}, {"t", "d"}, {"n"}, {"m"}, {"r", "ɹ"}, {"l"},
+                                  {"tʃ", "ʃ", "dʒ", "ʒ"}, {"k", "ɡ", "kw"}, {"f", "v"}, {"p", "b"}};
+
+    // No digit of their own, skipped in a word's full code (segmenter.h)
+    vector<string> silent_c{"h", "w", "j"};
+
+    vector<string> vowels[10]{{"uː"}, {"æ"}, {"e", "ɛ"}, {"ɪ"}, {"ɒ"}, {"ʊ"}, {"eɪ"}, {"iː"}, {"aɪ"}, {"əʊ"}};
   
     string any_vowel;
     string ignored = "[ˈˌ]"; // "ː" ignored only if rhotic
@@ -127,80 +141,26 @@ class PhonemePatternSettings {
       any_vowel = phonemes_to_group(&VOWELS);
     }
     
-    vector<string> get_consonants(uint8_t i) {
-      switch(i) {
-        case 0:
-          return digit0_c;
-          break;
-        case 1:
-          return digit1_c;
-          break;
-        case 2:
-          return digit2_c;
-          break;
-        case 3:
-          return digit3_c;
-          break;
-        case 4:
-          return digit4_c;
-          break;
-        case 5:
-          return digit5_c;
-          break;
-        case 6:
-          return digit6_c;
-          break;
-        case 7:
-          return digit7_c;
-          break;
-        case 8:
-          return digit8_c;
-          break;
-        case 9:
-          return digit9_c;
-          break;
-        default:
-          // should throw exception but don't know them yet
-          return digit0_c;
-      }
+    // Out of range digits get 0's, as they always have
+    const vector<string>& get_consonants(uint8_t i) const {
+      return consonants[i < 10 ? i : 0];
     }
 
-    vector<string> get_vowels(uint8_t i) {
-      switch(i) {
-        case 0:
-          return digit0_v;
-          break;
-        case 1:
-          return digit1_v;
-          break;
-        case 2:
-          return digit2_v;
-          break;
-        case 3:
-          return digit3_v;
-          break;
-        case 4:
-          return digit4_v;
-          break;
-        case 5:
-          return digit5_v;
-          break;
-        case 6:
-          return digit6_v;
-          break;
-        case 7:
-          return digit7_v;
-          break;
-        case 8:
-          return digit8_v;
-          break;
-        case 9:
-          return digit9_v;
-          break;
-        default:
-          // should throw exception but don't know them yet
-          return digit0_v;
-      }
+    const vector<string>& get_vowels(uint8_t i) const {
+      return vowels[i < 10 ? i : 0];
+    }
+
+    // For mapping profiles, see mapping_profile.h. False for a digit past 9.
+    bool set_consonants(uint8_t i, const vector<string>* phonemes) {
+      if(i >= 10) { return false; }
+      consonants[i] = *phonemes;
+      return true;
+    }
+
+    bool set_vowels(uint8_t i, const vector<string>* phonemes) {
+      if(i >= 10) { return false; }
+      vowels[i] = *phonemes;
+      return true;
     }
 };
 
@@ -213,80 +173,254 @@ class DigitPatternCompiler {
     }
   
     string compile_pattern(uint8_t digit1, uint8_t digit2, uint8_t digit3) {
-      vector<string> phoneme1 = settings->get_consonants(digit1);
-      vector<string> phoneme2;
-      vector<string> phoneme3 = settings->get_consonants(digit3);
-      if(settings->triple_mode == CCC) {
-        phoneme2 = settings->get_consonants(digit2);
-      } else {
-        phoneme2 = settings->get_vowels(digit2);
-      }
-      ostringstream ss;
-      ss << phonemes_to_group(&phoneme1);
-      ss << settings->ignored << "*";
+      string pattern;
+      compile_pattern(digit1, digit2, digit3, &pattern);
+      return pattern;
+    }
+
+    // Into out, which keeps its capacity, so a reused string doesn't allocate
+    void compile_pattern(uint8_t digit1, uint8_t digit2, uint8_t digit3, string* out) {
+      const vector<string>* phoneme1 = &settings->get_consonants(digit1);
+      const vector<string>* phoneme2 = settings->triple_mode == CCC
+        ? &settings->get_consonants(digit2) : &settings->get_vowels(digit2);
+      const vector<string>* phoneme3 = &settings->get_consonants(digit3);
+      out->clear();
+      append_group(phoneme1, out);
+      out->append(settings->ignored).append("*");
       if(settings->triple_mode == CCC) {
-        ss << settings->any_vowel << "*" << settings->rhotic << "?";
-        ss << settings->ignored << "*";
+        out->append(settings->any_vowel).append("*").append(settings->rhotic).append("?");
+        out->append(settings->ignored).append("*");
       }
-      ss << phonemes_to_group(&phoneme2);
-      ss << settings->ignored << "*";
+      append_group(phoneme2, out);
+      out->append(settings->ignored).append("*");
       if(settings->triple_mode == CCC) {
-        ss << settings->any_vowel << "*" << settings->rhotic << "?";
-        ss << settings->ignored << "*";
+        out->append(settings->any_vowel).append("*").append(settings->rhotic).append("?");
+        out->append(settings->ignored).append("*");
       }
-      ss << phonemes_to_group(&phoneme3);
+      append_group(phoneme3, out);
       if(!settings->strict_mode) {
-        ss << ".*";
+        out->append(".*");
       }
-
-      cout << "Pattern for " << +digit1 << +digit2 << +digit3;
-      cout << "'" << phoneme1[0] << phoneme2[0] << phoneme3[0] << "'";
-      cout << ": /" << ss.str() << endl;
-      return ss.str();
     }
 };
 
+// Words between WordContainer::load's progress reports
+const uint LOAD_CHUNK_WORDS = 4096;
+
 class WordContainer {
+  private:
+    mutex expand_lock;
+    uint expanded = 0;
+    // Set once compact is complete, words may still be read until then
+    atomic<bool> is_compact{false};
+
   public:
     vector<DictionaryWord> words;
     vector<uint> match_indexes;
-  
+    // Every word and IPA string back to back, each followed by a NUL
+    string arena;
+    // Set instead of arena when words point into a mapped cache
+    shared_ptr<MappedFile> mapping;
+    // Set by compact_words(), after which words and arena are only filled
+    // while someone holds expand()
+    FrontCodedWords compact;
+
+    WordContainer() { }
+
     WordContainer(const string* data_str) {
-      stringstream ss(*data_str);
-      string line;
-      smatch m;
-      regex line_template = regex("([^\t]+)\t/([^/]+)/", regex::extended);
-      while(getline(ss, line)) {
-        if(!regex_search(line, m, line_template)) { break; }
-        words.push_back(DictionaryWord{m[1], m[2]});
-      }
+      load(data_str->data(), data_str->size());
     }
 
     // TODO: Add file loader gui or remove this
     WordContainer(string file_name) {
-      fstream file;
-      file.open(file_name, ios::in);
-      if (file.is_open()) {
-        string line;
-        smatch m;
-        regex line_template = regex("([^\t]+)\t/([^/]+)/", regex::extended);
-        while(getline(file, line)) {
-          if(!regex_search(line, m, line_template)) { break; }
-          words.push_back(DictionaryWord{m[1], m[2]});
-        }
+      MappedFile file;
+      if (file.open(file_name)) {
+        load(file.data, file.size);
       } else {
         cout << "Could not open file " << file_name << endl;
       }
     }
 
-    uint set_filter(regex pattern) {
+    // words point into arena
+    WordContainer(const WordContainer&) = delete;
+    WordContainer& operator=(const WordContainer&) = delete;
+
+    // Single pass over "word\t/ipa/" lines, anything after the closing
+    // slash is ignored. Stops at the first line that doesn't fit. Every
+    // LOAD_CHUNK_WORDS words chunk_loaded(words so far, share of data read)
+    // is called, and those words may then be read from another thread
+    // while the rest load: neither words nor arena grow past what's
+    // reserved here, so neither ever moves.
+    void load(const char* data, size_t size, function<void(uint, float)> chunk_loaded = nullptr) {
+      // The arena never needs more than the input: each line loses at
+      // least "\t//" and gains two NULs.
+      mapping.reset();
+      arena.clear();
+      arena.reserve(size + 1);
+      words.clear();
+      words.reserve(count(data, data + size, '\n') + 1);
+      const char* end = data + size;
+      for(const char* line=data; line<end;) {
+        const char* line_end = (const char*)memchr(line, '\n', end-line);
+        if(line_end == nullptr) { line_end = end; }
+        const char* tab = (const char*)memchr(line, '\t', line_end-line);
+        if(tab == nullptr || tab == line || tab+1 >= line_end || tab[1] != '/') { break; }
+        const char* ipa = tab + 2;
+        const char* slash = (const char*)memchr(ipa, '/', line_end-ipa);
+        if(slash == nullptr || slash == ipa) { break; }
+
+        const char* word_copy = arena.data() + arena.size();
+        arena.append(line, tab-line);
+        arena.push_back('\0');
+        const char* ipa_copy = arena.data() + arena.size();
+        arena.append(ipa, slash-ipa);
+        arena.push_back('\0');
+        words.push_back(DictionaryWord{string_view(word_copy, tab-line), string_view(ipa_copy, slash-ipa)});
+        line = line_end + 1;
+        if(chunk_loaded && words.size() % LOAD_CHUNK_WORDS == 0) {
+          chunk_loaded(words.size(), float(line - data) / size);
+        }
+      }
+      if(chunk_loaded) { chunk_loaded(words.size(), 1); }
+    }
+
+    // Word i is base+offsets[2i] and its IPA base+offsets[2i+1], each
+    // running up to the NUL before the next offset.
+    void set_views(const char* base, const uint* offsets, uint num_words) {
+      words.clear();
+      words.reserve(num_words);
+      for(uint i=0; i<2*num_words; i+=2) {
+        words.push_back(DictionaryWord{
+          string_view(base + offsets[i], offsets[i+1] - offsets[i] - 1),
+          string_view(base + offsets[i+1], offsets[i+2] - offsets[i+1] - 1)});
+      }
+    }
+
+    // Words in static storage, e.g. compiled in by make_dictionary.cxx
+    void attach(const char* static_arena, const uint* offsets, uint num_words) {
+      arena.clear();
+      mapping.reset();
+      set_views(static_arena, offsets, num_words);
+    }
+
+    bool compacted() const {
+      return is_compact.load(memory_order_acquire);
+    }
+
+    uint size() const {
+      return compacted() ? compact.size() : words.size();
+    }
+
+    // Word i from whichever form is resident. Once compacted it's decoded
+    // into reader, so it's only valid until reader's next use.
+    DictionaryWord get(uint i, FrontCodedReader* reader) const {
+      if(!compacted()) { return words[i]; }
+      reader->get(&compact, i);
+      return DictionaryWord{reader->word, reader->ipa};
+    }
+
+    // Keeps only the front coded strings, dropping the views, the arena and
+    // any mapping. Anything that goes on reading words (or holds a view
+    // into them) must take expand() first.
+    void compact_words() {
+      compact.clear();
+      for(const DictionaryWord& word : words) {
+        compact.add(word.word, word.ipa);
+      }
+      compact.shrink();
+      if(compact.size() == 0) { return; }
+      lock_guard<mutex> guard(expand_lock);
+      is_compact.store(true, memory_order_release);
+      if(expanded == 0) {
+        words = vector<DictionaryWord>();
+        arena = string();
+        mapping.reset();
+      }
+    }
+
+    // Decodes the words back into arena and views until the matching
+    // release(). Nested and cross-thread holds share one copy.
+    void expand() {
+      lock_guard<mutex> guard(expand_lock);
+      if(expanded++ > 0 || !compacted() || !words.empty()) { return; }
+      FrontCodedReader reader;
+      vector<uint> offsets;
+      offsets.reserve(2*compact.size() + 1);
+      for(uint i=0; i<compact.size(); i++) {
+        reader.get(&compact, i);
+        offsets.push_back(arena.size());
+        arena.append(reader.word).push_back('\0');
+        offsets.push_back(arena.size());
+        arena.append(reader.ipa).push_back('\0');
+      }
+      offsets.push_back(arena.size());
+      set_views(arena.data(), offsets.data(), compact.size());
+    }
+
+    void release() {
+      lock_guard<mutex> guard(expand_lock);
+      if(expanded == 0 || --expanded > 0 || !compacted()) { return; }
+      words = vector<DictionaryWord>();
+      arena = string();
+    }
+
+    // Whether word i's IPA matches, decoding it into reader if compacted
+    bool ipa_matches(uint i, const regex* pattern, FrontCodedReader* reader) const {
+      string_view ipa = get(i, reader).ipa;
+      return regex_match(ipa.begin(), ipa.end(), *pattern);
+    }
+
+    uint set_filter(const regex* pattern) {
       match_indexes.clear();
-      for(uint i=0; i<words.size(); i++) {
-        if(regex_match(words[i].ipa, pattern)) {
+      FrontCodedReader reader;
+      for(uint i=0; i<size(); i++) {
+        if(ipa_matches(i, pattern, &reader)) {
           match_indexes.push_back(i);
         }
       }
     
       return match_indexes.size();
     }
+
+    // Same as above, split across the pool's threads
+    uint set_filter(const regex* pattern, WorkerPool* pool) {
+      return filter(pattern, &match_indexes, pool);
+    }
+
+    // Leaves match_indexes alone, for searching off the GUI thread. Each
+    // thread walks its chunk in order, so compacted words decode once.
+    uint filter(const regex* pattern, vector<uint>* out, WorkerPool* pool,
+                const atomic<bool>* cancelled = nullptr) {
+      return parallel_filter(pool, size(), [&](uint i) {
+        thread_local FrontCodedReader reader;
+        return ipa_matches(i, pattern, &reader);
+      }, out, cancelled);
+    }
+
+    // Candidates split across the pool, e.g. words through a prefilter
+    uint filter(const regex* pattern, const vector<uint>* candidates, vector<uint>* out, WorkerPool* pool,
+                const atomic<bool>* cancelled = nullptr) {
+      return parallel_filter(pool, candidates, [&](uint i) {
+        thread_local FrontCodedReader reader;
+        return ipa_matches(i, pattern, &reader);
+      }, out, cancelled);
+    }
+
+    // Only the given candidates, e.g. to narrow an earlier, looser result
+    uint filter(const regex* pattern, const vector<uint>* candidates, vector<uint>* out) {
+      out->clear();
+      thread_local FrontCodedReader reader;
+      for(uint i : *candidates) {
+        if(ipa_matches(i, pattern, &reader)) {
+          out->push_back(i);
+        }
+      }
+      return out->size();
+    }
+
+    // Precomputed bucket from WordIndex, see word_index.h
+    uint set_filter(const uint* bucket_begin, const uint* bucket_end) {
+      match_indexes.assign(bucket_begin, bucket_end);
+      return match_indexes.size();
+    }
 };
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PREFILTER_X86 1
+#endif
+
+#include "phonetics.h"
+
+
+using namespace std;
+
+// Each word's IPA is copied into a zero-padded slot this big so one AVX2
+// load (or two SSE2 loads) covers it. Longer ones take the scalar path.
+const uint PREFILTER_SLOT = 32;
+// A group with more distinct signature bytes than this isn't checked
+const uint MAX_SIGNATURE_BYTES = 8;
+
+enum PrefilterLevel { SCALAR_PREFILTER, SSE2_PREFILTER, AVX2_PREFILTER };
+
+const char* prefilter_level_name(PrefilterLevel level) {
+  switch(level) {
+    case AVX2_PREFILTER: return "avx2";
+    case SSE2_PREFILTER: return "sse2";
+    default: return "scalar";
+  }
+}
+
+// Bytes a word must contain one of if it holds any phoneme of a group: the
+// last byte of each, which for two-byte IPA letters is the one that tells
+// them apart. count == 0 means no check.
+struct ByteSignature {
+  uint8_t bytes[MAX_SIGNATURE_BYTES];
+  uint count = 0;
+  bool has[256] = {false}; // the same as a table, for the scalar path
+};
+
+// Necessary conditions for a digit triple's pattern: it starts with a first
+// digit phoneme, ends with a last digit phoneme if strict, and somewhere has
+// the signature bytes of the middle and last digits.
+struct PrefilterPattern {
+  vector<string> first;
+  vector<string> last;
+  ByteSignature first_bytes;
+  bool strict_mode;
+  ByteSignature middle;
+  ByteSignature final;
+};
+
+// Cheap test in front of the regex or DFA, which then only sees the words
+// that got through. Never rejects a word the pattern would match.
+class BytePrefilter {
+  private:
+    vector<uint8_t> slots;
+    const uint8_t* slot_data = nullptr; // first PREFILTER_SLOT aligned byte of slots
+    vector<uint8_t> lengths;    // PREFILTER_SLOT+1 for "too long, see words"
+    // Apart from the slots, so rejecting on it doesn't stream them all in.
+    // Zero past the last word, up to a whole vector.
+    vector<uint8_t> first_bytes;
+    const uint8_t* first_data = nullptr;
+    const vector<DictionaryWord>* words = nullptr;
+
+    // From the first or last byte of each phoneme
+    static ByteSignature signature(const vector<string>* phonemes, bool first) {
+      ByteSignature sig;
+      for(const string& phoneme : *phonemes) {
+        if(phoneme.empty()) { return ByteSignature(); }
+        uint8_t byte = first ? phoneme.front() : phoneme.back();
+        if(sig.has[byte]) { continue; }
+        if(sig.count == MAX_SIGNATURE_BYTES) { return ByteSignature(); }
+        sig.bytes[sig.count++] = byte;
+        sig.has[byte] = true;
+      }
+      return sig;
+    }
+
+    static bool has_prefix(const uint8_t* ipa, uint size, const vector<string>* phonemes) {
+      for(const string& phoneme : *phonemes) {
+        if(phoneme.size() <= size && memcmp(ipa, phoneme.data(), phoneme.size()) == 0) { return true; }
+      }
+      return false;
+    }
+
+    static bool has_suffix(const uint8_t* ipa, uint size, const vector<string>* phonemes) {
+      for(const string& phoneme : *phonemes) {
+        if(phoneme.size() <= size && memcmp(ipa + size - phoneme.size(), phoneme.data(), phoneme.size()) == 0) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    static bool has_signature(const uint8_t* ipa, uint size, const ByteSignature* sig) {
+      if(sig->count == 0) { return true; }
+      for(uint i=0; i<size; i++) {
+        if(sig->has[ipa[i]]) { return true; }
+      }
+      return false;
+    }
+
+    // The anchored checks, plus the signatures for words too long for a slot
+    bool scalar_match(const PrefilterPattern* pattern, uint i, bool check_signatures) const {
+      const uint8_t* ipa;
+      uint size = lengths[i];
+      if(size > PREFILTER_SLOT) {
+        ipa = (const uint8_t*)(*words)[i].ipa.data();
+        size = (*words)[i].ipa.size();
+        check_signatures = true;
+      } else {
+        ipa = slot_data + i*PREFILTER_SLOT;
+      }
+      if(!has_prefix(ipa, size, &pattern->first)) { return false; }
+      if(pattern->strict_mode && !has_suffix(ipa, size, &pattern->last)) { return false; }
+      if(!check_signatures) { return true; }
+      return has_signature(ipa, size, &pattern->middle) && has_signature(ipa, size, &pattern->final);
+    }
+
+    void filter_scalar(const PrefilterPattern* pattern, vector<uint>* out) const {
+      for(uint i=0; i<lengths.size(); i++) {
+        if(has_signature(&first_data[i], 1, &pattern->first_bytes) && scalar_match(pattern, i, true)) {
+          out->push_back(i);
+        }
+      }
+    }
+
+#ifdef PREFILTER_X86
+    __attribute__((target("sse2")))
+    static __m128i any_equal_sse2(__m128i data, const ByteSignature* sig) {
+      __m128i hits = _mm_setzero_si128();
+      for(uint b=0; b<sig->count; b++) {
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(data, _mm_set1_epi8((char)sig->bytes[b])));
+      }
+      return hits;
+    }
+
+    __attribute__((target("sse2")))
+    bool slot_match_sse2(const PrefilterPattern* pattern, uint i) const {
+      if(lengths[i] <= PREFILTER_SLOT) {
+        const __m128i* slot = (const __m128i*)(slot_data + i*PREFILTER_SLOT);
+        __m128i low = _mm_load_si128(slot);
+        __m128i high = _mm_load_si128(slot + 1);
+        for(const ByteSignature* sig : {&pattern->middle, &pattern->final}) {
+          if(sig->count > 0 && _mm_movemask_epi8(_mm_or_si128(any_equal_sse2(low, sig), any_equal_sse2(high, sig))) == 0) {
+            return false;
+          }
+        }
+      }
+      return scalar_match(pattern, i, false);
+    }
+
+    // 16 first bytes at a time, then the signatures of each survivor
+    __attribute__((target("sse2")))
+    void filter_sse2(const PrefilterPattern* pattern, vector<uint>* out) const {
+      for(uint i=0; i<lengths.size(); i+=16) {
+        uint mask = _mm_movemask_epi8(any_equal_sse2(_mm_load_si128((const __m128i*)(first_data + i)), &pattern->first_bytes));
+        for(; mask; mask &= mask-1) {
+          uint word = i + __builtin_ctz(mask);
+          if(slot_match_sse2(pattern, word)) { out->push_back(word); }
+        }
+      }
+    }
+
+    __attribute__((target("avx2")))
+    static __m256i any_equal_avx2(__m256i data, const ByteSignature* sig) {
+      __m256i hits = _mm256_setzero_si256();
+      for(uint b=0; b<sig->count; b++) {
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(data, _mm256_set1_epi8((char)sig->bytes[b])));
+      }
+      return hits;
+    }
+
+    __attribute__((target("avx2")))
+    bool slot_match_avx2(const PrefilterPattern* pattern, uint i) const {
+      if(lengths[i] <= PREFILTER_SLOT) {
+        __m256i slot = _mm256_load_si256((const __m256i*)(slot_data + i*PREFILTER_SLOT));
+        for(const ByteSignature* sig : {&pattern->middle, &pattern->final}) {
+          if(sig->count > 0 && _mm256_movemask_epi8(any_equal_avx2(slot, sig)) == 0) { return false; }
+        }
+      }
+      return scalar_match(pattern, i, false);
+    }
+
+    // 32 first bytes at a time, then the signatures of each survivor
+    __attribute__((target("avx2")))
+    void filter_avx2(const PrefilterPattern* pattern, vector<uint>* out) const {
+      for(uint i=0; i<lengths.size(); i+=32) {
+        uint mask = _mm256_movemask_epi8(any_equal_avx2(_mm256_load_si256((const __m256i*)(first_data + i)), &pattern->first_bytes));
+        for(; mask; mask &= mask-1) {
+          uint word = i + __builtin_ctz(mask);
+          if(slot_match_avx2(pattern, word)) { out->push_back(word); }
+        }
+      }
+    }
+#endif
+
+  public:
+    // Best the CPU supports, can be lowered to compare
+    PrefilterLevel level = SCALAR_PREFILTER;
+
+    BytePrefilter() {
+#ifdef PREFILTER_X86
+      __builtin_cpu_init();
+      if(__builtin_cpu_supports("avx2")) {
+        level = AVX2_PREFILTER;
+      } else if(__builtin_cpu_supports("sse2")) {
+        level = SSE2_PREFILTER;
+      }
+#endif
+    }
+
+    // To compare a lower level, never above what the CPU supports. False
+    // if level was more than it could do.
+    bool lower_to(PrefilterLevel level) {
+      if(level > this->level) { return false; }
+      this->level = level;
+      return true;
+    }
+
+    void build(const vector<DictionaryWord>* words) {
+      this->words = words;
+      // Over-allocated so the slots can start on a 32 byte boundary
+      slots.assign(words->size()*PREFILTER_SLOT + PREFILTER_SLOT, 0);
+      uint skip = (PREFILTER_SLOT - (uintptr_t)slots.data() % PREFILTER_SLOT) % PREFILTER_SLOT;
+      slot_data = slots.data() + skip;
+      uint8_t* slot = slots.data() + skip;
+      lengths.resize(words->size());
+      first_bytes.assign(words->size() + 2*PREFILTER_SLOT, 0);
+      skip = (PREFILTER_SLOT - (uintptr_t)first_bytes.data() % PREFILTER_SLOT) % PREFILTER_SLOT;
+      first_data = first_bytes.data() + skip;
+      for(uint i=0; i<words->size(); i++) {
+        string_view ipa = (*words)[i].ipa;
+        first_bytes[skip + i] = ipa.empty() ? 0 : ipa[0];
+        if(ipa.size() > PREFILTER_SLOT) {
+          lengths[i] = PREFILTER_SLOT+1;
+        } else {
+          lengths[i] = ipa.size();
+          memcpy(slot + i*PREFILTER_SLOT, ipa.data(), ipa.size());
+        }
+      }
+    }
+
+    bool built() {
+      return words != nullptr;
+    }
+
+    PrefilterPattern compile(PhonemePatternSettings* settings, uint8_t digit1, uint8_t digit2, uint8_t digit3) {
+      PrefilterPattern pattern;
+      pattern.first = settings->get_consonants(digit1);
+      pattern.last = settings->get_consonants(digit3);
+      pattern.strict_mode = settings->strict_mode;
+      const vector<string>& middle = settings->triple_mode == CCC
+        ? settings->get_consonants(digit2) : settings->get_vowels(digit2);
+      pattern.first_bytes = signature(&pattern.first, true);
+      pattern.middle = signature(&middle, false);
+      pattern.final = signature(&pattern.last, false);
+      return pattern;
+    }
+
+    // Indexes of the words that might match, ascending
+    uint filter(const PrefilterPattern* pattern, vector<uint>* out) const {
+      out->clear();
+#ifdef PREFILTER_X86
+      // The vector paths need first bytes to look for
+      if(pattern->first_bytes.count == 0) {
+        filter_scalar(pattern, out);
+        return out->size();
+      }
+      if(level == AVX2_PREFILTER) {
+        filter_avx2(pattern, out);
+        return out->size();
+      }
+      if(level == SSE2_PREFILTER) {
+        filter_sse2(pattern, out);
+        return out->size();
+      }
+#endif
+      filter_scalar(pattern, out);
+      return out->size();
+    }
+};
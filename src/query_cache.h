@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "phonetics.h"
+
+
+using namespace std;
+
+// Results of recent scans keyed by (code, triple_mode, strict_mode), least
+// recently used dropped first once the stored indexes pass max_bytes.
+// Counters are atomic so the GUI can read them while the search thread
+// works; the cache itself belongs to one thread.
+class QueryCache {
+  private:
+    struct Entry {
+      uint key;
+      vector<uint> match_indexes;
+    };
+
+    list<Entry> entries; // most recently used first
+    unordered_map<uint, list<Entry>::iterator> lookup;
+    size_t max_bytes;
+    size_t bytes = 0;
+
+    static size_t entry_bytes(const Entry* entry) {
+      return sizeof(Entry) + entry->match_indexes.size()*sizeof(uint);
+    }
+
+  public:
+    // Served straight from the cache
+    atomic<uint64_t> hits{0};
+    // Strict results refined from a cached incomplete-match set
+    atomic<uint64_t> refinements{0};
+    // Needed a dictionary scan
+    atomic<uint64_t> misses{0};
+
+    QueryCache(size_t max_bytes) {
+      this->max_bytes = max_bytes;
+    }
+
+    static uint make_key(uint code, PhonemeTripleMode mode, bool strict) {
+      return (code*2 + mode)*2 + (strict ? 1 : 0);
+    }
+
+    // Valid until the next insert
+    const vector<uint>* find(uint key) {
+      auto found = lookup.find(key);
+      if(found == lookup.end()) { return nullptr; }
+      entries.splice(entries.begin(), entries, found->second);
+      return &found->second->match_indexes;
+    }
+
+    // Takes the contents of match_indexes
+    const vector<uint>* insert(uint key, vector<uint>* match_indexes) {
+      auto found = lookup.find(key);
+      if(found != lookup.end()) {
+        bytes -= entry_bytes(&*found->second);
+        entries.erase(found->second);
+        lookup.erase(found);
+      }
+      entries.push_front(Entry{key, vector<uint>()});
+      entries.front().match_indexes.swap(*match_indexes);
+      lookup[key] = entries.begin();
+      bytes += entry_bytes(&entries.front());
+
+      // The newest entry always stays, however big
+      while(bytes > max_bytes && entries.size() > 1) {
+        bytes -= entry_bytes(&entries.back());
+        lookup.erase(entries.back().key);
+        entries.pop_back();
+      }
+      return &entries.front().match_indexes;
+    }
+
+    // Drops the entries for which pred(code, mode, strict) holds
+    template<typename Predicate>
+    uint erase_if(Predicate pred) {
+      uint erased = 0;
+      for(auto entry=entries.begin(); entry!=entries.end();) {
+        uint key = entry->key;
+        if(!pred(key/4, (PhonemeTripleMode)(key/2%2), key%2 == 1)) {
+          entry++;
+          continue;
+        }
+        bytes -= entry_bytes(&*entry);
+        lookup.erase(key);
+        entry = entries.erase(entry);
+        erased++;
+      }
+      return erased;
+    }
+
+    void clear() {
+      entries.clear();
+      lookup.clear();
+      bytes = 0;
+    }
+
+    size_t size() {
+      return entries.size();
+    }
+};
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "async_search.h"
+#include "mapping_profile.h"
+#include "near_miss.h"
+#include "phoneme_matcher.h"
+#include "phonetics.h"
+#include "prefilter.h"
+#include "query_cache.h"
+#include "ranker.h"
+#include "reverse_index.h"
+#include "segmenter.h"
+#include "trace.h"
+#include "word_index.h"
+#include "worker_pool.h"
+
+
+using namespace std;
+
+// Splits listed for a long number, with up to SPLIT_EXTRA_WORDS more words than the fewest
+const uint MAX_SPLITS = 50;
+const uint SPLIT_EXTRA_WORDS = 2;
+// Room reserved for a compiled pattern, the longest is under half this
+const uint PATTERN_RESERVE = 1024;
+// Results with fewer matches than this get near misses added, up to MAX_NEAR_MISSES
+const uint NEAR_MISS_BELOW = 10;
+const uint MAX_NEAR_MISSES = 200;
+// Type-ahead rows for a word prefix
+const uint MAX_LOOKUPS = 200;
+
+// One query from digits to match_indexes, for the search thread. Buffers
+// are kept between queries, so once every result has been seen (an index
+// bucket, or a cached scan) a query doesn't touch the heap. Scans that miss
+// the cache, long numbers and word lookups still allocate.
+class QueryRunner {
+  private:
+    MatchEngine engine;
+    // Owned by the search thread, the GUI has its own
+    PhonemePatternSettings* settings;
+    WordContainer* word_container;
+    WordIndex* word_index;
+    PhonemeMatcher* phoneme_matcher;
+    WorkerPool* pool;
+    QueryCache* query_cache;
+    BytePrefilter* prefilter;
+    // Built, nullptr to leave results alphabetical
+    WordRanker* ranker;
+    DigitPatternCompiler compiler;
+    // Built on the first long number
+    DigitTrie digit_trie;
+    NumberSegmenter segmenter;
+    bool digit_trie_built = false;
+    // Built on the first word looked up
+    ReverseIndex reverse_index;
+    bool reverse_index_built = false;
+    // Built on the first query short of matches
+    NearMissSearch near_search;
+    vector<NearMiss> near;
+    vector<uint> candidates;
+    vector<uint> matches;
+    string pattern_str;
+    uint current_profile = 0;
+
+    // Moves everything built from the digit mappings over to another
+    // profile, redoing only what the changed digits reach
+    void use_profile(uint index) {
+      TraceScope scope("profile");
+      const MappingProfile* profile = &(*profiles)[index];
+      DigitChange change = digit_change(settings, profile);
+      apply_profile(profile, settings);
+      current_profile = index;
+      if(!change.any()) { return; }
+      word_container->expand();
+      word_index->update(&change, &word_container->words);
+      query_cache->erase_if([&change](uint code, PhonemeTripleMode mode, bool) {
+        return change.affects(mode, code);
+      });
+      if(near_search.built()) { near_search.update(&change); }
+      if(ranker != nullptr) { ranker->update(settings, &change); }
+      word_container->release();
+      digit_trie_built = false;
+      reverse_index_built = false;
+    }
+
+    // Whole dictionary through the regex or DFA engine, per settings. The
+    // prefilter drops almost every word first, the engine checks the rest.
+    // The scalar prefilter is slower than the DFA it would save. Compacted
+    // words go without, see LocaleOptions::compact_words.
+    void scan(const SearchQuery* query, vector<uint>* out, const atomic<bool>* cancelled) {
+      if(engine == REGEX_ENGINE && !prefilter->built()) {
+        compiler.compile_pattern(query->digit1, query->digit2, query->digit3, &pattern_str);
+        regex pattern(pattern_str, regex::extended);
+        word_container->filter(&pattern, out, pool, cancelled);
+        return;
+      }
+      if(engine == DFA_ENGINE && (prefilter->level == SCALAR_PREFILTER || !prefilter->built())) {
+        PhonemeDfa dfa = phoneme_matcher->compile(query->digit1, query->digit2, query->digit3);
+        phoneme_matcher->filter(&dfa, out, pool, cancelled);
+        return;
+      }
+      PrefilterPattern prefilter_pattern = prefilter->compile(settings, query->digit1, query->digit2,
+                                                              query->digit3);
+      prefilter->filter(&prefilter_pattern, &candidates);
+      if(engine == REGEX_ENGINE) {
+        compiler.compile_pattern(query->digit1, query->digit2, query->digit3, &pattern_str);
+        regex pattern(pattern_str, regex::extended);
+        word_container->filter(&pattern, &candidates, out, pool, cancelled);
+      } else {
+        PhonemeDfa dfa = phoneme_matcher->compile(query->digit1, query->digit2, query->digit3);
+        phoneme_matcher->filter(&dfa, &candidates, out, pool, cancelled);
+      }
+    }
+
+    void refine(const SearchQuery* query, const vector<uint>* candidates, vector<uint>* out) {
+      if(engine == REGEX_ENGINE) {
+        compiler.compile_pattern(query->digit1, query->digit2, query->digit3, &pattern_str);
+        regex pattern(pattern_str, regex::extended);
+        word_container->filter(&pattern, candidates, out);
+      } else {
+        PhonemeDfa dfa = phoneme_matcher->compile(query->digit1, query->digit2, query->digit3);
+        phoneme_matcher->filter(&dfa, candidates, out);
+      }
+    }
+
+    // Near misses that aren't among the exact matches (ascending), nearest
+    // then best ranked first
+    void find_near_misses(const SearchQuery* query, const vector<uint>* exact) {
+      if(!near_search.built()) {
+        word_container->expand();
+        near_search.build(&word_container->words);
+        word_container->release();
+        near.reserve(word_container->size());
+      }
+      settings->triple_mode = query->triple_mode;
+      settings->strict_mode = query->strict_mode;
+      near_search.search(query->digit1, query->digit2, query->digit3, near_miss_distance, &near);
+      near.erase(remove_if(near.begin(), near.end(), [exact](const NearMiss& miss) {
+        return binary_search(exact->begin(), exact->end(), miss.word);
+      }), near.end());
+      PhonemeTripleMode mode = query->triple_mode;
+      WordRanker* ranker = this->ranker;
+      uint keep = min((uint)near.size(), MAX_NEAR_MISSES);
+      partial_sort(near.begin(), near.begin() + keep, near.end(), [ranker, mode](const NearMiss& a, const NearMiss& b) {
+        if(a.distance != b.distance) { return a.distance < b.distance; }
+        float score_a = ranker != nullptr ? ranker->score(a.word, mode) : 0;
+        float score_b = ranker != nullptr ? ranker->score(b.word, mode) : 0;
+        if(score_a != score_b) { return score_a > score_b; }
+        return a.word < b.word;
+      });
+      near.resize(keep);
+    }
+
+    // Words starting with word, see SearchResult::lookup_word
+    void look_up(const string& word, SearchResult* result) {
+      if(!reverse_index_built) {
+        TraceScope scope("reverse index");
+        reverse_index.build(settings, word_container);
+        reverse_index_built = true;
+      }
+      TraceScope scope("lookup");
+      result->lookup_word = word;
+      reverse_index.find_prefix(word, MAX_LOOKUPS, &result->match_indexes);
+      for(uint i : result->match_indexes) {
+        result->lookup_codes.push_back(string(reverse_index.code(i)));
+      }
+      uint exact;
+      result->exact_count = reverse_index.find(word, &exact) ? 1 : 0;
+    }
+
+  public:
+    // Most edits a near miss can be, 0 for none
+    uint near_miss_distance = 1;
+    // Queries pick one by SearchQuery::profile, nullptr for the settings as given
+    const vector<MappingProfile>* profiles = nullptr;
+
+    // The profile settings already hold, when it isn't profiles' first
+    void set_profile(uint index) {
+      current_profile = index;
+    }
+
+    QueryRunner(MatchEngine engine, PhonemePatternSettings* settings, WordContainer* word_container,
+                WordIndex* word_index, PhonemeMatcher* phoneme_matcher, WorkerPool* pool,
+                QueryCache* query_cache, BytePrefilter* prefilter, WordRanker* ranker)
+        : compiler(settings), segmenter(&digit_trie), near_search(settings) {
+      this->engine = engine;
+      this->settings = settings;
+      this->word_container = word_container;
+      this->word_index = word_index;
+      this->phoneme_matcher = phoneme_matcher;
+      this->pool = pool;
+      this->query_cache = query_cache;
+      this->prefilter = prefilter;
+      this->ranker = ranker;
+      candidates.reserve(word_container->size());
+      matches.reserve(word_container->size());
+      pattern_str.reserve(PATTERN_RESERVE);
+    }
+
+    // Into result, which may hold an older query's result. It's grown big
+    // enough for any result the first time, and kept.
+    void run(const SearchQuery* query, SearchResult* result, const atomic<bool>* cancelled) {
+      TraceScope scope("search");
+      result->pattern.reserve(PATTERN_RESERVE);
+      result->match_indexes.reserve(word_container->size());
+      result->pattern.clear();
+      result->match_indexes.clear();
+      result->exact_count = 0;
+      result->long_number.clear();
+      result->segmentations.clear();
+      result->lookup_word.clear();
+      result->lookup_codes.clear();
+      if(profiles != nullptr && query->profile != current_profile && query->profile < profiles->size()) {
+        use_profile(query->profile);
+      }
+      if(!query->long_number.empty()) {
+        if(!digit_trie_built) {
+          word_container->expand();
+          digit_trie.build(settings, &word_container->words);
+          word_container->release();
+          digit_trie_built = true;
+        }
+        result->long_number = query->long_number;
+        TraceScope split_scope("split");
+        segmenter.segment(query->long_number, MAX_SPLITS, SPLIT_EXTRA_WORDS, &result->segmentations);
+        return;
+      }
+      if(!query->lookup_word.empty()) {
+        look_up(query->lookup_word, result);
+        return;
+      }
+      find_matches(query, result, cancelled);
+      if(cancelled->load()) { return; }
+      result->exact_count = result->match_indexes.size();
+      near.clear();
+      if(near_miss_distance > 0 && result->exact_count < NEAR_MISS_BELOW) {
+        TraceScope near_scope("near");
+        find_near_misses(query, &result->match_indexes);
+      }
+      if(ranker != nullptr) {
+        TraceScope rank_scope("rank");
+        ranker->rank(&result->match_indexes, query->triple_mode, TOP_RESULTS);
+      }
+      for(const NearMiss& miss : near) {
+        result->match_indexes.push_back(miss.word);
+      }
+    }
+
+    // match_indexes in dictionary order
+    void find_matches(const SearchQuery* query, SearchResult* result, const atomic<bool>* cancelled) {
+      settings->triple_mode = query->triple_mode;
+      settings->strict_mode = query->strict_mode;
+      {
+        TraceScope scope("compile");
+        compiler.compile_pattern(query->digit1, query->digit2, query->digit3, &result->pattern);
+      }
+      TraceScope scope("filter");
+      uint code = query->digit1*100 + query->digit2*10 + query->digit3;
+      if(engine == INDEX_ENGINE) {
+        WordBucket bucket = word_index->get_bucket(query->triple_mode, query->strict_mode, code);
+        result->match_indexes.assign(bucket.begin(), bucket.end());
+        return;
+      }
+
+      uint key = QueryCache::make_key(code, query->triple_mode, query->strict_mode);
+      const vector<uint>* cached = query_cache->find(key);
+      if(cached != nullptr) {
+        query_cache->hits++;
+        result->match_indexes.assign(cached->begin(), cached->end());
+        return;
+      }
+
+      // Strict matches are a subset of the incomplete ones for the same
+      // digits, so strict queries narrow down the incomplete set.
+      uint loose_key = QueryCache::make_key(code, query->triple_mode, false);
+      const vector<uint>* loose = query_cache->find(loose_key);
+      bool refined = loose != nullptr;
+      if(loose == nullptr) {
+        settings->strict_mode = false;
+        scan(query, &matches, cancelled);
+        if(cancelled->load()) { return; }
+        query_cache->misses++;
+        loose = query_cache->insert(loose_key, &matches);
+      }
+      if(!query->strict_mode) {
+        result->match_indexes.assign(loose->begin(), loose->end());
+        return;
+      }
+      settings->strict_mode = true;
+      refine(query, loose, &result->match_indexes);
+      if(refined) { query_cache->refinements++; }
+      matches.assign(result->match_indexes.begin(), result->match_indexes.end());
+      query_cache->insert(key, &matches);
+    }
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.h"
+#include "mapping_profile.h"
+#include "phonetics.h"
+#include "word_coder.h"
+
+
+using namespace std;
+
+// Rows ranked to the top of the table, the rest stay alphabetical
+const uint TOP_RESULTS = 100;
+
+// Spellings that are rarely something you can picture
+const char* ABSTRACT_SUFFIXES[] = {
+  "ness", "ity", "tion", "sion", "ment", "ism", "ship", "hood", "ance", "ence",
+  "ing", "ly", "ous", "ive", "ful", "less", "able", "ible", "ize", "ise",
+};
+
+const float FREQUENCY_WEIGHT = 3;
+const float EXTRA_CONSONANT_WEIGHT = 1;
+const float ABSTRACT_WEIGHT = 1.5;
+const float STRESS_WEIGHT = 1;
+
+// Orders a result so the likeliest pegs come first: common words (from an
+// optional frequency list), concrete-looking spellings, no consonants past
+// the coded ones and the primary stress on the coded sounds. Scores are
+// worked out once per word, ranking only picks the best TOP_RESULTS.
+class WordRanker {
+  private:
+    const vector<DictionaryWord>* words = nullptr;
+    WordCoder coder;
+    // 0-1, log scaled, 0 for words not in the list or without one
+    vector<float> frequency;
+    // [mode][word]
+    vector<float> scores[2];
+    // Reused by rank, best TOP_RESULTS as (score, word)
+    vector<pair<float, uint>> heap;
+    vector<uint> chosen;
+
+    static bool better(const pair<float, uint>& a, const pair<float, uint>& b) {
+      return a.first > b.first || (a.first == b.first && a.second < b.second);
+    }
+
+    static bool abstract(string_view word) {
+      for(const char* suffix : ABSTRACT_SUFFIXES) {
+        size_t size = strlen(suffix);
+        if(word.size() > size+2 && word.compare(word.size()-size, size, suffix) == 0) { return true; }
+      }
+      return false;
+    }
+
+    void score_word(uint i) {
+      const string_view stress = "ˈ";
+      string_view ipa = (*words)[i].ipa;
+      uint offsets[3];
+      uint count = coder.consonants(ipa, offsets, 3);
+      for(PhonemeTripleMode mode : {CCC, CVC}) {
+        // CVC codes two consonants, the vowel sits between them
+        uint coded = mode == CCC ? 3 : 2;
+        float score = frequency.empty() ? 0 : FREQUENCY_WEIGHT*frequency[i];
+        if(count > coded) { score -= EXTRA_CONSONANT_WEIGHT*(count - coded); }
+        if(abstract((*words)[i].word)) { score -= ABSTRACT_WEIGHT; }
+        // No mark is a single syllable, stressed throughout
+        size_t stress_at = ipa.find(stress);
+        if(stress_at == string_view::npos || (count >= coded && stress_at < offsets[coded-1])) {
+          score += STRESS_WEIGHT;
+        }
+        scores[mode][i] = score;
+      }
+    }
+
+    void score_words() {
+      for(PhonemeTripleMode mode : {CCC, CVC}) {
+        scores[mode].resize(words->size());
+      }
+      for(uint i=0; i<words->size(); i++) {
+        score_word(i);
+      }
+    }
+
+  public:
+    void build(PhonemePatternSettings* settings, const vector<DictionaryWord>* words) {
+      this->words = words;
+      coder.setup(settings);
+      if(frequency.size() != words->size()) { frequency.clear(); }
+      score_words();
+      heap.reserve(TOP_RESULTS);
+      chosen.reserve(TOP_RESULTS);
+    }
+
+    bool built() {
+      return words != nullptr;
+    }
+
+    // Rescores the words holding a moved phoneme
+    void update(PhonemePatternSettings* settings, const DigitChange* change) {
+      coder.setup(settings);
+      for(uint i=0; i<words->size(); i++) {
+        if(change->touches((*words)[i].ipa)) { score_word(i); }
+      }
+    }
+
+    // "word count" per line, or just a word per line most common first.
+    // Words not in the dictionary are ignored. Call before build.
+    bool load_frequencies(string file_name, const vector<DictionaryWord>* words) {
+      MappedFile file;
+      if(!file.open(file_name)) { return false; }
+      unordered_map<string_view, uint> by_word;
+      by_word.reserve(words->size());
+      for(uint i=0; i<words->size(); i++) {
+        by_word.emplace((*words)[i].word, i);
+      }
+      vector<double> counts(words->size(), 0);
+      const char* end = file.data + file.size;
+      uint line_number = 0;
+      double most = 0;
+      string word;
+      for(const char* line=file.data; line<end; line_number++) {
+        const char* line_end = (const char*)memchr(line, '\n', end-line);
+        if(line_end == nullptr) { line_end = end; }
+        const char* split = line;
+        while(split < line_end && *split != ' ' && *split != '\t' && *split != '\r') { split++; }
+        word.assign(line, split);
+        transform(word.begin(), word.end(), word.begin(), ::tolower);
+        // Without a count, rank stands in for one
+        double count = split < line_end ? atof(split) : 0;
+        if(count <= 0) { count = 1e6 / (line_number+1); }
+        auto found = by_word.find(word);
+        if(found != by_word.end() && counts[found->second] == 0) {
+          counts[found->second] = count;
+          most = max(most, count);
+        }
+        line = line_end + 1;
+      }
+      frequency.assign(words->size(), 0);
+      if(most == 0) { return true; }
+      for(uint i=0; i<words->size(); i++) {
+        frequency[i] = log1p(counts[i]) / log1p(most);
+      }
+      return true;
+    }
+
+    float score(uint word_index, PhonemeTripleMode mode) const {
+      return scores[mode][word_index];
+    }
+
+    // Moves the best k (at most TOP_RESULTS) of match_indexes (ascending) to
+    // the front, best first, and leaves the rest in order behind them. A
+    // bounded heap, so it's linear in the result size rather than a full
+    // sort, and doesn't allocate.
+    void rank(vector<uint>* match_indexes, PhonemeTripleMode mode, uint k) {
+      k = min(k, TOP_RESULTS);
+      if(match_indexes->size() <= 1 || k == 0) { return; }
+      const float* mode_scores = scores[mode].data();
+      heap.clear();
+      for(uint i : *match_indexes) {
+        pair<float, uint> entry(mode_scores[i], i);
+        if(heap.size() < k) {
+          heap.push_back(entry);
+          push_heap(heap.begin(), heap.end(), better);
+        } else if(better(entry, heap.front())) {
+          pop_heap(heap.begin(), heap.end(), better);
+          heap.back() = entry;
+          push_heap(heap.begin(), heap.end(), better);
+        }
+      }
+      sort_heap(heap.begin(), heap.end(), better);
+
+      chosen.clear();
+      for(const pair<float, uint>& entry : heap) { chosen.push_back(entry.second); }
+      sort(chosen.begin(), chosen.end());
+      // From the back so the rest slide down behind the chosen in place
+      uint* data = match_indexes->data();
+      uint write = match_indexes->size();
+      uint next_chosen = chosen.size();
+      for(uint read=match_indexes->size(); read-- > 0;) {
+        if(next_chosen > 0 && chosen[next_chosen-1] == data[read]) {
+          next_chosen--;
+        } else {
+          data[--write] = data[read];
+        }
+      }
+      for(uint i=0; i<heap.size(); i++) {
+        data[i] = heap[i].second;
+      }
+    }
+};
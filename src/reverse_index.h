@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "phonetics.h"
+#include "word_coder.h"
+
+
+using namespace std;
+
+// Word -> number. Every word's full code is worked out once (see WordCoder),
+// then a hash answers exact words and a sorted list answers prefixes, so
+// type-ahead never scans the dictionary.
+class ReverseIndex {
+  private:
+    bool has_words = false;
+    WordCoder coder;
+    // Code of word i is code_data[code_offsets[i]..code_offsets[i+1]),
+    // empty for words without one
+    string code_data;
+    vector<uint> code_offsets;
+    // Its own copy of the spellings, the IPA isn't needed once coded, so
+    // a compacted dictionary can stay compacted. Word i is
+    // spelling_data[spelling_offsets[i]..spelling_offsets[i+1]).
+    string spelling_data;
+    vector<uint> spelling_offsets;
+    unordered_map<string_view, uint> by_word;
+    vector<uint> sorted_words;
+
+  public:
+    void build(PhonemePatternSettings* settings, const WordContainer* word_container) {
+      coder.setup(settings);
+      uint num_words = word_container->size();
+      code_data.clear();
+      code_offsets.assign(1, 0);
+      spelling_data.clear();
+      spelling_offsets.assign(1, 0);
+      FrontCodedReader reader;
+      string code;
+      for(uint i=0; i<num_words; i++) {
+        DictionaryWord word = word_container->get(i, &reader);
+        if(coder.word_code(word.ipa, &code)) {
+          code_data += code;
+        }
+        code_offsets.push_back(code_data.size());
+        spelling_data.append(word.word);
+        spelling_offsets.push_back(spelling_data.size());
+      }
+      // Views only once spelling_data has stopped growing
+      by_word.clear();
+      by_word.reserve(num_words);
+      sorted_words.resize(num_words);
+      for(uint i=0; i<num_words; i++) {
+        // First spelling wins if the dictionary repeats a word
+        by_word.emplace(word(i), i);
+        sorted_words[i] = i;
+      }
+      sort(sorted_words.begin(), sorted_words.end(), [this](uint a, uint b) {
+        return word(a) < word(b);
+      });
+      has_words = true;
+    }
+
+    bool built() {
+      return has_words;
+    }
+
+    string_view word(uint word_index) const {
+      return string_view(spelling_data).substr(spelling_offsets[word_index],
+                                               spelling_offsets[word_index+1] - spelling_offsets[word_index]);
+    }
+
+    string_view code(uint word_index) const {
+      return string_view(code_data).substr(code_offsets[word_index],
+                                           code_offsets[word_index+1] - code_offsets[word_index]);
+    }
+
+    // Index of exactly this word, false if it isn't in the dictionary
+    bool find(string_view word, uint* word_index) const {
+      auto found = by_word.find(word);
+      if(found == by_word.end()) { return false; }
+      *word_index = found->second;
+      return true;
+    }
+
+    // Up to max_results words starting with prefix, alphabetically, with
+    // the exact word (if any) first
+    uint find_prefix(string_view prefix, uint max_results, vector<uint>* out) const {
+      out->clear();
+      uint exact;
+      if(find(prefix, &exact)) { out->push_back(exact); }
+      auto first = lower_bound(sorted_words.begin(), sorted_words.end(), prefix, [this](uint i, string_view p) {
+        return word(i) < p;
+      });
+      for(auto i=first; i<sorted_words.end() && out->size()<max_results; i++) {
+        if(word(*i).compare(0, prefix.size(), prefix) != 0) { break; }
+        if(out->empty() || *i != out->front()) { out->push_back(*i); }
+      }
+      return out->size();
+    }
+};
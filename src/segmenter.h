@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "phonetics.h"
+#include "word_coder.h"
+#include "word_index.h"
+
+
+using namespace std;
+
+// A stretch of a long number and the words whose whole code is exactly it
+struct CodeSegment {
+  uint begin;
+  uint length;
+  WordBucket words;
+};
+
+typedef vector<CodeSegment> Segmentation;
+
+// No run of words finishes the number from here
+const uint NO_SPLIT = ~0u;
+
+// Every word's full Major code in a trie over the digits 0-9, built once
+// from the dictionary. Words without a code (see WordCoder) are left out.
+class DigitTrie {
+  public:
+    WordCoder coder;
+    // [node*10 + digit] -> child node, 0 for none (the root is never a child)
+    vector<uint> children;
+    // Words sorted by code, node n's words are
+    // words_by_code[node_words[2n]..node_words[2n+1])
+    vector<uint> words_by_code;
+    vector<uint> node_words;
+    uint longest_code = 0;
+
+    void build(PhonemePatternSettings* settings, const vector<DictionaryWord>* words) {
+      coder.setup(settings);
+      vector<pair<string, uint>> coded;
+      string code;
+      for(uint i=0; i<words->size(); i++) {
+        if(coder.word_code((*words)[i].ipa, &code)) {
+          coded.push_back(make_pair(code, i));
+        }
+      }
+      sort(coded.begin(), coded.end());
+
+      children.assign(10, 0);
+      node_words.assign(2, 0);
+      words_by_code.clear();
+      longest_code = 0;
+      for(uint i=0; i<coded.size(); i++) {
+        uint node = 0;
+        for(char c : coded[i].first) {
+          uint slot = node*10 + (c - '0');
+          if(children[slot] == 0) {
+            children[slot] = children.size()/10;
+            children.resize(children.size() + 10, 0);
+            node_words.resize(node_words.size() + 2, 0);
+          }
+          node = children[slot];
+        }
+        // Same code as the previous word, so the same node: extend its run
+        if(node_words[2*node] == node_words[2*node+1]) {
+          node_words[2*node] = words_by_code.size();
+        }
+        words_by_code.push_back(coded[i].second);
+        node_words[2*node+1] = words_by_code.size();
+        longest_code = max(longest_code, (uint)coded[i].first.size());
+      }
+    }
+
+    uint size() {
+      return words_by_code.size();
+    }
+
+    WordBucket node_bucket(uint node) const {
+      return WordBucket{words_by_code.data() + node_words[2*node],
+                        words_by_code.data() + node_words[2*node+1]};
+    }
+};
+
+// Splits a long number into runs that each have dictionary words, fewest
+// words first. A table of the fewest and most words that can finish the
+// number from each digit keeps the search to splits that work out exactly.
+class NumberSegmenter {
+  private:
+    const DigitTrie* trie;
+    string_view digits;
+    uint max_results;
+    vector<uint> fewest;
+    vector<uint> most;
+    Segmentation path;
+    vector<Segmentation>* out;
+
+    // Ends of every word starting at begin, longest first
+    void word_ends(uint begin, vector<uint>* nodes, vector<uint>* ends) {
+      nodes->clear();
+      ends->clear();
+      uint node = 0;
+      for(uint i=begin; i<digits.size(); i++) {
+        node = trie->children[node*10 + (digits[i] - '0')];
+        if(node == 0) { break; }
+        if(trie->node_bucket(node).size() > 0) {
+          nodes->push_back(node);
+          ends->push_back(i+1);
+        }
+      }
+      reverse(nodes->begin(), nodes->end());
+      reverse(ends->begin(), ends->end());
+    }
+
+    void search(uint begin, uint words_left) {
+      if(out->size() >= max_results) { return; }
+      if(begin == digits.size()) {
+        if(words_left == 0) { out->push_back(path); }
+        return;
+      }
+      if(words_left == 0) { return; }
+      vector<uint> nodes, ends;
+      word_ends(begin, &nodes, &ends);
+      for(uint i=0; i<ends.size(); i++) {
+        uint end = ends[i];
+        if(fewest[end] == NO_SPLIT || fewest[end] > words_left-1 || most[end] < words_left-1) { continue; }
+        path.push_back(CodeSegment{begin, end-begin, trie->node_bucket(nodes[i])});
+        search(end, words_left-1);
+        path.pop_back();
+      }
+    }
+
+  public:
+    NumberSegmenter(const DigitTrie* trie) {
+      this->trie = trie;
+    }
+
+    // Up to max_results splits of digits (only '0'-'9'), using at most
+    // extra_words more words than the fewest possible. Empty if no split
+    // works at all.
+    uint segment(string_view digits, uint max_results, uint extra_words, vector<Segmentation>* out) {
+      out->clear();
+      this->digits = digits;
+      this->max_results = max_results;
+      this->out = out;
+      uint size = digits.size();
+      fewest.assign(size+1, NO_SPLIT);
+      most.assign(size+1, 0);
+      fewest[size] = 0;
+      vector<uint> nodes, ends;
+      for(uint begin=size; begin-- > 0;) {
+        word_ends(begin, &nodes, &ends);
+        for(uint end : ends) {
+          if(fewest[end] == NO_SPLIT) { continue; }
+          if(fewest[begin] == NO_SPLIT || fewest[end]+1 < fewest[begin]) { fewest[begin] = fewest[end]+1; }
+          most[begin] = max(most[begin], most[end]+1);
+        }
+      }
+      if(fewest[0] == NO_SPLIT) { return 0; }
+      for(uint words=fewest[0]; words<=min(most[0], fewest[0]+extra_words); words++) {
+        path.clear();
+        search(0, words);
+      }
+      return out->size();
+    }
+};
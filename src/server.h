@@ -0,0 +1,294 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "batch.h"
+#include "mapping_profile.h"
+#include "phonetics.h"
+#include "ranker.h"
+#include "word_index.h"
+
+
+using namespace std;
+
+// Words per response when a query doesn't give a limit
+const uint DEFAULT_SERVER_LIMIT = 20;
+// A connection isn't read from while this much output waits for it
+const size_t MAX_PENDING_OUTPUT = 1 << 20;
+const size_t SERVER_READ_SIZE = 64 << 10;
+
+struct ServerOptions {
+  string socket_path; // empty for stdin/stdout
+  string dict_file;   // empty for the built-in dictionary
+  string freq_file;
+  // Digit mappings other than the built-in ones
+  const MappingProfile* profile = nullptr;
+};
+
+volatile sig_atomic_t server_stopping = 0;
+
+void stop_server(int) {
+  server_stopping = 1;
+}
+
+// Answers peg queries one per line, for scripts:
+//
+//   NUMBER [ccc|cvc] [strict|loose] [LIMIT]
+//
+// NUMBER is 1-3 digits, the rest default to cvc, loose and 20 words (0 for
+// all). Each query gets one tab separated line back, in order:
+//
+//   ok <TAB> NUMBER <TAB> MODE <TAB> STRICT <TAB> COUNT <TAB> word word ...
+//   error <TAB> message
+//
+// COUNT is every match, the words are the best LIMIT of them. Only the best
+// TOP_RESULTS (100) are ranked, so words past those follow in dictionary
+// order. Queries can be pipelined; whatever has arrived is answered in one
+// write.
+class QueryServer {
+  private:
+    struct Connection {
+      int fd;
+      string in;
+      string out;
+      bool closing = false;
+    };
+
+    PhonemePatternSettings settings;
+    WordContainer word_container;
+    PhonemeMatcher matcher;
+    WordIndex word_index;
+    WordRanker ranker;
+    vector<uint> matches;
+    vector<string_view> fields;
+
+    static void error_line(string* out, const char* message) {
+      out->append("error\t").append(message).push_back('\n');
+    }
+
+    void answer_line(string_view line, string* out) {
+      fields.clear();
+      for(size_t pos=0; pos<line.size();) {
+        size_t end = line.find_first_of(" \t\r", pos);
+        if(end == string_view::npos) { end = line.size(); }
+        if(end > pos) { fields.push_back(line.substr(pos, end-pos)); }
+        pos = end + 1;
+      }
+      if(fields.empty()) { return; }
+
+      string_view number = fields[0];
+      if(number.size() > 3) { return error_line(out, "number must be 1-3 digits"); }
+      uint code = 0;
+      for(char c : number) {
+        if(c < '0' || c > '9') { return error_line(out, "number must be 1-3 digits"); }
+        code = code*10 + (c - '0');
+      }
+      PhonemeTripleMode mode = CVC;
+      bool strict = false;
+      uint limit = DEFAULT_SERVER_LIMIT;
+      for(uint i=1; i<fields.size(); i++) {
+        if(fields[i] == "ccc") {
+          mode = CCC;
+        } else if(fields[i] == "cvc") {
+          mode = CVC;
+        } else if(fields[i] == "strict") {
+          strict = true;
+        } else if(fields[i] == "loose") {
+          strict = false;
+        } else if(fields[i].find_first_not_of("0123456789") == string_view::npos && fields[i].size() < 9) {
+          limit = atoi(string(fields[i]).c_str());
+        } else {
+          return error_line(out, "expected ccc, cvc, strict, loose or a limit");
+        }
+      }
+
+      WordBucket bucket = word_index.get_bucket(mode, strict, code);
+      matches.assign(bucket.begin(), bucket.end());
+      ranker.rank(&matches, mode, TOP_RESULTS);
+      char head[64];
+      snprintf(head, sizeof(head), "ok\t%03u\t%s\t%s\t%zu\t", code, mode == CCC ? "ccc" : "cvc",
+               strict ? "strict" : "loose", matches.size());
+      out->append(head);
+      uint shown = limit == 0 ? matches.size() : min((uint)matches.size(), limit);
+      for(uint i=0; i<shown; i++) {
+        if(i > 0) { out->push_back(' '); }
+        out->append(word_container.words[matches[i]].word);
+      }
+      out->push_back('\n');
+    }
+
+    // Answers every whole line of in and drops them
+    void answer(string* in, string* out) {
+      size_t start = 0;
+      while(true) {
+        size_t end = in->find('\n', start);
+        if(end == string::npos) { break; }
+        answer_line(string_view(*in).substr(start, end-start), out);
+        start = end + 1;
+      }
+      in->erase(0, start);
+    }
+
+    static bool write_all(int fd, const string* out) {
+      for(size_t done=0; done<out->size();) {
+        ssize_t written = write(fd, out->data() + done, out->size() - done);
+        if(written < 0 && errno == EINTR) { continue; }
+        if(written <= 0) { return false; }
+        done += written;
+      }
+      return true;
+    }
+
+    // Reads what's there, false once the connection is finished with
+    bool read_connection(Connection* connection) {
+      size_t size = connection->in.size();
+      connection->in.resize(size + SERVER_READ_SIZE);
+      ssize_t got = read(connection->fd, &connection->in[size], SERVER_READ_SIZE);
+      connection->in.resize(size + max(got, (ssize_t)0));
+      if(got < 0) { return errno == EAGAIN || errno == EINTR; }
+      if(got == 0) {
+        // A last query without a newline still gets answered
+        if(!connection->in.empty()) { connection->in.push_back('\n'); }
+        connection->closing = true;
+      }
+      answer(&connection->in, &connection->out);
+      return true;
+    }
+
+    bool flush_connection(Connection* connection) {
+      while(!connection->out.empty()) {
+        ssize_t written = send(connection->fd, connection->out.data(), connection->out.size(), MSG_NOSIGNAL);
+        if(written < 0) { return errno == EAGAIN || errno == EINTR; }
+        connection->out.erase(0, written);
+      }
+      return true;
+    }
+
+  public:
+    QueryServer() : matcher(&settings), word_index(&settings) { }
+
+    bool load(const ServerOptions* options) {
+      if(options->profile != nullptr) { apply_profile(options->profile, &settings); }
+      BatchOptions batch_options;
+      batch_options.dict_file = options->dict_file;
+      if(!load_batch_dictionary(&batch_options, &word_container, &matcher)) { return false; }
+      if(options->dict_file.empty()) {
+        load_builtin_index(&word_index, &settings, &word_container.words);
+      } else {
+        word_index.build(&word_container.words);
+      }
+      if(!options->freq_file.empty() && !ranker.load_frequencies(options->freq_file, &word_container.words)) {
+        fprintf(stderr, "Could not open %s\n", options->freq_file.c_str());
+      }
+      ranker.build(&settings, &word_container.words);
+      matches.reserve(word_container.words.size());
+      return true;
+    }
+
+    int serve_stdio() {
+      Connection connection;
+      connection.fd = 0;
+      while(!connection.closing) {
+        if(!read_connection(&connection)) { return 1; }
+        if(!write_all(1, &connection.out)) { return 1; }
+        connection.out.clear();
+      }
+      return 0;
+    }
+
+    // Any number of clients, one thread, until SIGINT or SIGTERM
+    int serve_socket(const string& path) {
+      sockaddr_un address;
+      memset(&address, 0, sizeof(address));
+      address.sun_family = AF_UNIX;
+      if(path.size() >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+        return 1;
+      }
+      memcpy(address.sun_path, path.c_str(), path.size());
+      // Only a socket left by an earlier run is replaced, never a file
+      struct stat existing;
+      if(lstat(path.c_str(), &existing) == 0) {
+        if(!S_ISSOCK(existing.st_mode)) {
+          fprintf(stderr, "Not a socket, won't replace it: %s\n", path.c_str());
+          return 1;
+        }
+        unlink(path.c_str());
+      }
+      int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+      if(listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 128) != 0) {
+        fprintf(stderr, "Could not listen on %s: %s\n", path.c_str(), strerror(errno));
+        return 1;
+      }
+      fcntl(listener, F_SETFL, O_NONBLOCK);
+      signal(SIGINT, stop_server);
+      signal(SIGTERM, stop_server);
+      fprintf(stderr, "Listening on %s\n", path.c_str());
+
+      vector<Connection> connections;
+      vector<pollfd> polled;
+      while(!server_stopping) {
+        polled.clear();
+        polled.push_back(pollfd{listener, POLLIN, 0});
+        for(const Connection& connection : connections) {
+          short events = connection.out.size() < MAX_PENDING_OUTPUT && !connection.closing ? POLLIN : 0;
+          if(!connection.out.empty()) { events |= POLLOUT; }
+          polled.push_back(pollfd{connection.fd, events, 0});
+        }
+        if(poll(polled.data(), polled.size(), -1) < 0) {
+          if(errno == EINTR) { continue; }
+          break;
+        }
+        for(uint i=connections.size(); i-- > 0;) {
+          Connection* connection = &connections[i];
+          short events = polled[i+1].revents;
+          bool ok = true;
+          if(!connection->closing && (events & (POLLIN | POLLHUP))) { ok = read_connection(connection); }
+          if(ok && (events & POLLERR)) { ok = false; }
+          if(ok) { ok = flush_connection(connection); }
+          if(!ok || (connection->closing && connection->out.empty())) {
+            close(connection->fd);
+            connections.erase(connections.begin() + i);
+          }
+        }
+        if(polled[0].revents & POLLIN) {
+          int fd;
+          while((fd = accept(listener, nullptr, nullptr)) >= 0) {
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            Connection connection;
+            connection.fd = fd;
+            connections.push_back(connection);
+          }
+        }
+      }
+      for(const Connection& connection : connections) {
+        close(connection.fd);
+      }
+      close(listener);
+      unlink(path.c_str());
+      return 0;
+    }
+};
+
+int run_server(const ServerOptions* options) {
+  QueryServer server;
+  auto start = chrono::steady_clock::now();
+  if(!server.load(options)) { return 1; }
+  fprintf(stderr, "Loaded in %.1fms\n", chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+  return options->socket_path.empty() ? server.serve_stdio() : server.serve_socket(options->socket_path);
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+using namespace std;
+
+// Spans kept, the oldest are overwritten once it wraps
+const uint TRACE_RING_SIZE = 1 << 16;
+
+// A timed stretch of work, or an instant when end == start. Fields are
+// atomics so a dump can run while other threads record; seq is written
+// last and tells the dump whether the slot holds a whole span.
+struct TraceSlot {
+  atomic<uint64_t> seq{0};
+  atomic<const char*> name{nullptr};
+  atomic<uint64_t> start{0}; // ns since the tracer started
+  atomic<uint64_t> end{0};
+  atomic<uint32_t> thread{0};
+};
+
+// Lock-free ring of timestamped spans from any thread, off by default.
+// When off, a TraceScope costs one relaxed load. Names must be string
+// literals, only the pointer is stored. Dumped as Chrome trace JSON, for
+// chrome://tracing or Perfetto.
+class Tracer {
+  private:
+    unique_ptr<TraceSlot[]> slots;
+    atomic<uint64_t> next{0};
+    atomic<uint32_t> next_thread{0};
+    chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+
+    uint32_t thread_id() {
+      thread_local uint32_t id = ++next_thread;
+      return id;
+    }
+
+  public:
+    atomic<bool> enabled{false};
+
+    // Allocates the ring, call before any thread records
+    void enable() {
+      if(!slots) { slots.reset(new TraceSlot[TRACE_RING_SIZE]); }
+      enabled = true;
+    }
+
+    uint64_t now() const {
+      return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count();
+    }
+
+    void record(const char* name, uint64_t start, uint64_t end) {
+      uint64_t ticket = next.fetch_add(1, memory_order_relaxed);
+      TraceSlot* slot = &slots[ticket % TRACE_RING_SIZE];
+      slot->seq.store(0, memory_order_relaxed);
+      atomic_thread_fence(memory_order_release);
+      slot->name.store(name, memory_order_relaxed);
+      slot->start.store(start, memory_order_relaxed);
+      slot->end.store(end, memory_order_relaxed);
+      slot->thread.store(thread_id(), memory_order_relaxed);
+      slot->seq.store(ticket + 1, memory_order_release);
+    }
+
+    void instant(const char* name) {
+      if(!enabled.load(memory_order_relaxed)) { return; }
+      uint64_t at = now();
+      record(name, at, at);
+    }
+
+    // Whatever the ring holds, oldest first. Slots being written are skipped.
+    bool write_chrome_trace(const string& file_name) {
+      FILE* out = fopen(file_name.c_str(), "w");
+      if(out == nullptr) { return false; }
+      fputs("{\"traceEvents\":[\n", out);
+      bool first = true;
+      if(slots) {
+        uint64_t last = next.load(memory_order_acquire);
+        uint64_t begin = last > TRACE_RING_SIZE ? last - TRACE_RING_SIZE : 0;
+        for(uint64_t ticket=begin; ticket<last; ticket++) {
+          TraceSlot* slot = &slots[ticket % TRACE_RING_SIZE];
+          uint64_t seq = slot->seq.load(memory_order_acquire);
+          const char* name = slot->name.load(memory_order_relaxed);
+          uint64_t start = slot->start.load(memory_order_relaxed);
+          uint64_t end = slot->end.load(memory_order_relaxed);
+          uint32_t thread = slot->thread.load(memory_order_relaxed);
+          atomic_thread_fence(memory_order_acquire);
+          if(seq != ticket + 1 || slot->seq.load(memory_order_relaxed) != seq) { continue; }
+          if(end == start) {
+            fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                    first ? "" : ",\n", name, start/1000.0, thread);
+          } else {
+            fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                    first ? "" : ",\n", name, start/1000.0, (end - start)/1000.0, thread);
+          }
+          first = false;
+        }
+      }
+      fputs("\n]}\n", out);
+      return fclose(out) == 0;
+    }
+};
+
+Tracer tracer;
+
+// Records its lifetime as a span named name
+class TraceScope {
+  private:
+    const char* name;
+    bool active;
+    uint64_t start = 0;
+
+  public:
+    TraceScope(const char* name) {
+      this->name = name;
+      active = tracer.enabled.load(memory_order_relaxed);
+      if(active) { start = tracer.now(); }
+    }
+
+    // At least 1ns, a zero length span would read as an instant
+    ~TraceScope() {
+      if(active) { tracer.record(name, start, max(tracer.now(), start + 1)); }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
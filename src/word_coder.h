@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "phonetics.h"
+
+
+using namespace std;
+
+// What phoneme_classes() turns each sound into: the digit for a consonant
+// with one, then these
+const uint8_t NO_DIGIT_CLASS = 10;
+const uint8_t VOWEL_CLASS = 11; // + the vowel's digit
+const uint8_t OTHER_VOWEL_CLASS = 21;
+const uint NUM_PHONEME_CLASSES = 22;
+
+// A word's full Major code: a digit for each consonant in turn, not just the
+// first three. Follows the consonant table in the settings: silent_c, stress
+// marks and anything that isn't a consonant are skipped, and a word with a
+// consonant that has no digit (θ, ŋ, ...) has no code.
+class WordCoder {
+  private:
+    struct Phoneme {
+      string ipa;
+      int digit; // SKIPPED or NO_DIGIT otherwise
+      int vowel; // digit of a vowel, OTHER_VOWEL or NOT_VOWEL
+    };
+    static const int SKIPPED = -1;
+    static const int NO_DIGIT = -2;
+    static const int NOT_VOWEL = -1;
+    static const int OTHER_VOWEL = 10;
+    // By first byte, longest first so tʃ wins over t
+    vector<Phoneme> phonemes[256];
+
+    void add_phonemes(const vector<string>* ipa, int digit, int vowel = NOT_VOWEL) {
+      for(const string& p : *ipa) {
+        if(!p.empty()) { phonemes[(unsigned char)p[0]].push_back(Phoneme{p, digit, vowel}); }
+      }
+    }
+
+    // The table entry at ipa[*pos] and moves pos past it, nullptr for a
+    // vowel or mark outside the tables, which is skipped
+    const Phoneme* next_phoneme(string_view ipa, uint* pos) const {
+      for(const Phoneme& phoneme : phonemes[(unsigned char)ipa[*pos]]) {
+        if(ipa.compare(*pos, phoneme.ipa.size(), phoneme.ipa) == 0) {
+          *pos += phoneme.ipa.size();
+          return &phoneme;
+        }
+      }
+      (*pos)++;
+      while(*pos < ipa.size() && (ipa[*pos] & 0xC0) == 0x80) { (*pos)++; }
+      return nullptr;
+    }
+
+  public:
+    void setup(PhonemePatternSettings* settings) {
+      for(vector<Phoneme>& lead : phonemes) { lead.clear(); }
+      for(uint8_t d=0; d<10; d++) {
+        vector<string> consonants = settings->get_consonants(d);
+        vector<string> vowels = settings->get_vowels(d);
+        add_phonemes(&consonants, d);
+        add_phonemes(&vowels, SKIPPED, d);
+      }
+      add_phonemes(&VOWELS, SKIPPED, OTHER_VOWEL);
+      add_phonemes(&settings->silent_c, SKIPPED);
+      string skipped = bracket_bytes(&settings->ignored) + bracket_bytes(&settings->rhotic);
+      for(char c : skipped) {
+        phonemes[(unsigned char)c].push_back(Phoneme{string(1, c), SKIPPED, NOT_VOWEL});
+      }
+      // After the above, so the first entry for a phoneme wins
+      add_phonemes(&CONSONANTS, NO_DIGIT);
+      for(vector<Phoneme>& lead : phonemes) {
+        stable_sort(lead.begin(), lead.end(), [](const Phoneme& a, const Phoneme& b) {
+          return a.ipa.size() > b.ipa.size();
+        });
+      }
+    }
+
+    // Replaces out with the word's code, false if it has none
+    bool word_code(string_view ipa, string* out) const {
+      out->clear();
+      for(uint pos=0; pos<ipa.size();) {
+        const Phoneme* found = next_phoneme(ipa, &pos);
+        if(found == nullptr || found->digit == SKIPPED) { continue; }
+        if(found->digit == NO_DIGIT) { return false; }
+        out->push_back('0' + found->digit);
+      }
+      return !out->empty();
+    }
+
+    // Appends each consonant's class and, if with_vowels, each vowel's, in
+    // turn. Stress marks and the like are left out.
+    void phoneme_classes(string_view ipa, bool with_vowels, vector<uint8_t>* out) const {
+      for(uint pos=0; pos<ipa.size();) {
+        const Phoneme* found = next_phoneme(ipa, &pos);
+        if(found == nullptr) { continue; }
+        if(found->digit >= 0) {
+          out->push_back(found->digit);
+        } else if(found->digit == NO_DIGIT) {
+          out->push_back(NO_DIGIT_CLASS);
+        } else if(with_vowels && found->vowel != NOT_VOWEL) {
+          out->push_back(found->vowel == OTHER_VOWEL ? OTHER_VOWEL_CLASS : VOWEL_CLASS + found->vowel);
+        }
+      }
+    }
+
+    // Number of consonants, with or without a digit, and the byte offsets
+    // of the first max_offsets of them
+    uint consonants(string_view ipa, uint* offsets, uint max_offsets) const {
+      uint count = 0;
+      for(uint pos=0; pos<ipa.size();) {
+        uint begin = pos;
+        const Phoneme* found = next_phoneme(ipa, &pos);
+        if(found == nullptr || found->digit == SKIPPED) { continue; }
+        if(count < max_offsets) { offsets[count] = begin; }
+        count++;
+      }
+      return count;
+    }
+};
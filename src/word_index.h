@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "mapping_profile.h"
+#include "phonetics.h"
+
+
+using namespace std;
+
+const uint NUM_CODES = 1000;
+const uint NUM_BUCKETS = 4*NUM_CODES;
+
+// A run of ascending indexes into WordContainer::words
+struct WordBucket {
+  const uint* first;
+  const uint* last;
+
+  const uint* begin() const { return first; }
+  const uint* end() const { return last; }
+  uint size() const { return last - first; }
+};
+
+// Everything a WordIndex depends on, so a prebuilt index can be checked
+// against the settings in use.
+string settings_fingerprint(PhonemePatternSettings* settings) {
+  string fingerprint = phonemes_to_group(&VOWELS) + settings->ignored + settings->rhotic;
+  for(uint8_t d=0; d<10; d++) {
+    vector<string> consonants = settings->get_consonants(d);
+    vector<string> vowels = settings->get_vowels(d);
+    fingerprint += to_string(d) + phonemes_to_group(&consonants) + phonemes_to_group(&vowels);
+  }
+  return fingerprint;
+}
+
+// Every 000-999 code precomputed for both triple modes and both strictness
+// settings, so a query is a bucket fetch instead of a dictionary scan.
+//
+// Rather than running 4000 regexes over the dictionary, each word is walked
+// once per triple mode following the same grammar that
+// DigitPatternCompiler::compile_pattern emits, collecting every code whose
+// pattern would match it.
+class WordIndex {
+  private:
+    PhonemePatternSettings* settings;
+    vector<string> consonants[10];
+    vector<string> vowels[10];
+    string ignored;
+    string rhotic;
+
+    // scratch for a single word, reused between words
+    vector<bool> gap1;
+    vector<bool> gap2;
+    vector<bool> vowel_run;
+    vector<uint> pending;
+    vector<uint> strict_codes;
+    vector<uint> loose_codes;
+
+    static bool starts_with(string_view s, uint pos, const string* phoneme) {
+      return s.compare(pos, phoneme->size(), *phoneme) == 0;
+    }
+
+    // Positions reachable from pos by `class*`
+    static uint skip_class(string_view s, uint pos, const string* byte_class) {
+      while(pos < s.size() && byte_class->find(s[pos]) != string::npos) {
+        pos++;
+      }
+      return pos;
+    }
+
+    // Marks every position reachable from pos by the gap between two
+    // phonemes: `ignored*` for CVC, plus `any_vowel* rhotic? ignored*` for CCC.
+    void mark_gap(string_view s, uint pos, PhonemeTripleMode mode, vector<bool>* out) {
+      uint end = skip_class(s, pos, &ignored);
+      for(uint p=pos; p<=end; p++) {
+        if(mode == CVC) {
+          (*out)[p] = true;
+          continue;
+        }
+        // (any_vowel)*
+        fill(vowel_run.begin(), vowel_run.end(), false);
+        pending.clear();
+        pending.push_back(p);
+        vowel_run[p] = true;
+        while(!pending.empty()) {
+          uint q = pending.back();
+          pending.pop_back();
+          for(const string& vowel : VOWELS) {
+            if(starts_with(s, q, &vowel) && !vowel_run[q+vowel.size()]) {
+              vowel_run[q+vowel.size()] = true;
+              pending.push_back(q+vowel.size());
+            }
+          }
+        }
+        for(uint q=0; q<=s.size(); q++) {
+          if(!vowel_run[q]) { continue; }
+          // rhotic? ignored*
+          uint after = q < s.size() && rhotic.find(s[q]) != string::npos ? q+1 : q;
+          for(uint r=q; r<=after; r++) {
+            uint r_end = skip_class(s, r, &ignored);
+            for(uint t=r; t<=r_end; t++) {
+              (*out)[t] = true;
+            }
+          }
+        }
+      }
+    }
+
+    void add_codes(string_view ipa, PhonemeTripleMode mode) {
+      uint size = ipa.size();
+      gap1.assign(size+1, false);
+      vowel_run.assign(size+1, false);
+      strict_codes.clear();
+      loose_codes.clear();
+
+      for(uint d1=0; d1<10; d1++) {
+        for(const string& c1 : consonants[d1]) {
+          if(!starts_with(ipa, 0, &c1)) { continue; }
+          fill(gap1.begin(), gap1.end(), false);
+          mark_gap(ipa, c1.size(), mode, &gap1);
+
+          for(uint d2=0; d2<10; d2++) {
+            const vector<string>* group2 = mode == CCC ? &consonants[d2] : &vowels[d2];
+            gap2.assign(size+1, false);
+            bool any_middle = false;
+            for(uint p=0; p<=size; p++) {
+              if(!gap1[p]) { continue; }
+              for(const string& c2 : *group2) {
+                if(starts_with(ipa, p, &c2)) {
+                  mark_gap(ipa, p+c2.size(), mode, &gap2);
+                  any_middle = true;
+                }
+              }
+            }
+            if(!any_middle) { continue; }
+
+            for(uint d3=0; d3<10; d3++) {
+              uint code = d1*100 + d2*10 + d3;
+              for(uint p=0; p<=size; p++) {
+                if(!gap2[p]) { continue; }
+                for(const string& c3 : consonants[d3]) {
+                  if(!starts_with(ipa, p, &c3)) { continue; }
+                  loose_codes.push_back(code);
+                  if(p + c3.size() == size) {
+                    strict_codes.push_back(code);
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+
+    static void push_unique(vector<uint>* codes, vector<uint>* buckets, uint word_index) {
+      sort(codes->begin(), codes->end());
+      codes->erase(unique(codes->begin(), codes->end()), codes->end());
+      for(uint code : *codes) {
+        buckets[code].push_back(word_index);
+      }
+    }
+
+    // The phonemes the buckets are built for
+    void capture_settings() {
+      for(uint8_t d=0; d<10; d++) {
+        consonants[d] = settings->get_consonants(d);
+        vowels[d] = settings->get_vowels(d);
+      }
+      ignored = bracket_bytes(&settings->ignored);
+      rhotic = bracket_bytes(&settings->rhotic);
+    }
+
+    void set_buckets(vector<uint>* words, vector<uint>* offsets) {
+      bucket_words.swap(*words);
+      bucket_offsets.swap(*offsets);
+      bucket_data = bucket_words.data();
+      bucket_offset_data = bucket_offsets.data();
+    }
+
+    static uint bucket_slot(PhonemeTripleMode mode, bool strict, uint code) {
+      return (mode*2 + (strict ? 1 : 0))*NUM_CODES + code;
+    }
+
+  public:
+    // All buckets back to back, bucket_slot() s is
+    // bucket_data[bucket_offset_data[s]..bucket_offset_data[s+1]).
+    // Points at the vectors below, or at tables compiled into the binary.
+    vector<uint> bucket_words;
+    vector<uint> bucket_offsets;
+    const uint* bucket_data = nullptr;
+    const uint* bucket_offset_data = nullptr;
+
+    WordIndex(PhonemePatternSettings* settings) {
+      this->settings = settings;
+    }
+
+    // Buckets built ahead of time for the same settings and words
+    void attach(const uint* bucket_data, const uint* bucket_offset_data) {
+      capture_settings();
+      bucket_words.clear();
+      bucket_offsets.clear();
+      this->bucket_data = bucket_data;
+      this->bucket_offset_data = bucket_offset_data;
+    }
+
+    void build(const vector<DictionaryWord>* words) {
+      capture_settings();
+      vector<vector<uint>> buckets(NUM_BUCKETS);
+      for(uint i=0; i<words->size(); i++) {
+        string_view ipa = (*words)[i].ipa;
+        for(PhonemeTripleMode mode : {CCC, CVC}) {
+          add_codes(ipa, mode);
+          push_unique(&loose_codes, &buckets[bucket_slot(mode, false, 0)], i);
+          push_unique(&strict_codes, &buckets[bucket_slot(mode, true, 0)], i);
+        }
+      }
+
+      vector<uint> words_out;
+      vector<uint> offsets;
+      for(const vector<uint>& bucket : buckets) {
+        offsets.push_back(words_out.size());
+        words_out.insert(words_out.end(), bucket.begin(), bucket.end());
+      }
+      offsets.push_back(words_out.size());
+      set_buckets(&words_out, &offsets);
+    }
+
+    // After the settings' digits changed (see mapping_profile.h): only the
+    // words holding a moved phoneme can change codes, so only they are
+    // coded again. Every bucket is its old words less those, merged with
+    // their new codes. Returns how many words were coded.
+    uint update(const DigitChange* change, const vector<DictionaryWord>* words) {
+      if(ignored != bracket_bytes(&settings->ignored) || rhotic != bracket_bytes(&settings->rhotic)) {
+        build(words);
+        return words->size();
+      }
+      capture_settings();
+      vector<bool> touched(words->size(), false);
+      vector<vector<uint>> added(NUM_BUCKETS);
+      uint walked = 0;
+      for(uint i=0; i<words->size(); i++) {
+        string_view ipa = (*words)[i].ipa;
+        if(!change->touches(ipa)) { continue; }
+        touched[i] = true;
+        walked++;
+        for(PhonemeTripleMode mode : {CCC, CVC}) {
+          add_codes(ipa, mode);
+          push_unique(&loose_codes, &added[bucket_slot(mode, false, 0)], i);
+          push_unique(&strict_codes, &added[bucket_slot(mode, true, 0)], i);
+        }
+      }
+      if(walked == 0) { return 0; }
+
+      vector<uint> words_out;
+      vector<uint> offsets;
+      words_out.reserve(bucket_offset_data[NUM_BUCKETS] + walked);
+      for(uint slot=0; slot<NUM_BUCKETS; slot++) {
+        offsets.push_back(words_out.size());
+        const uint* old = bucket_data + bucket_offset_data[slot];
+        const uint* old_end = bucket_data + bucket_offset_data[slot+1];
+        const vector<uint>& add = added[slot];
+        uint next = 0;
+        for(; old < old_end; old++) {
+          if(touched[*old]) { continue; }
+          while(next < add.size() && add[next] < *old) { words_out.push_back(add[next++]); }
+          words_out.push_back(*old);
+        }
+        words_out.insert(words_out.end(), add.begin() + next, add.end());
+      }
+      offsets.push_back(words_out.size());
+      set_buckets(&words_out, &offsets);
+      return walked;
+    }
+
+    WordBucket get_bucket(PhonemeTripleMode mode, bool strict, uint code) {
+      uint slot = bucket_slot(mode, strict, code);
+      return WordBucket{bucket_data + bucket_offset_data[slot], bucket_data + bucket_offset_data[slot+1]};
+    }
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+using namespace std;
+
+// Fixed set of threads running parallel-for jobs. The calling thread works
+// on the job too, so a pool of 1 runs everything inline. One job at a time.
+class WorkerPool {
+  private:
+    vector<thread> threads;
+    mutex lock;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(uint)>* job = nullptr;
+    uint num_tasks = 0;
+    atomic<uint> next_task{0};
+    uint busy = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void work() {
+      while(true) {
+        uint task = next_task++;
+        if(task >= num_tasks) { return; }
+        (*job)(task);
+      }
+    }
+
+    void worker_loop() {
+      uint64_t seen = 0;
+      unique_lock<mutex> guard(lock);
+      while(true) {
+        wake.wait(guard, [&]{ return stopping || generation != seen; });
+        if(stopping) { return; }
+        seen = generation;
+        guard.unlock();
+        work();
+        guard.lock();
+        if(--busy == 0) { done.notify_all(); }
+      }
+    }
+
+  public:
+    // 0 threads means one per hardware core
+    WorkerPool(uint num_threads) {
+      if(num_threads == 0) {
+        num_threads = max(1u, thread::hardware_concurrency());
+      }
+      for(uint i=1; i<num_threads; i++) {
+        threads.emplace_back(&WorkerPool::worker_loop, this);
+      }
+    }
+
+    ~WorkerPool() {
+      {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+      }
+      wake.notify_all();
+      for(thread& t : threads) {
+        t.join();
+      }
+    }
+
+    uint size() {
+      return threads.size() + 1;
+    }
+
+    // Calls job(0) .. job(num_tasks-1) across the pool, returns when all are done
+    void run(uint num_tasks, const function<void(uint)>& job) {
+      {
+        lock_guard<mutex> guard(lock);
+        this->job = &job;
+        this->num_tasks = num_tasks;
+        next_task = 0;
+        busy = threads.size();
+        generation++;
+      }
+      wake.notify_all();
+      work();
+      unique_lock<mutex> guard(lock);
+      done.wait(guard, [&]{ return busy == 0; });
+      this->job = nullptr;
+    }
+};
+
+// Indexes in [0, count) for which matches(i) holds, in order. The range is
+// split into chunks that collect matches locally and are merged in order,
+// so the result is the same as a single-threaded loop. Setting *cancelled
+// stops early, leaving a partial result.
+template<typename Predicate>
+uint parallel_filter(WorkerPool* pool, uint count, Predicate matches, vector<uint>* out,
+                     const atomic<bool>* cancelled = nullptr) {
+  uint num_chunks = pool->size() == 1 ? 1 : pool->size()*4;
+  uint chunk_size = (count + num_chunks-1) / num_chunks;
+  vector<vector<uint>> chunk_matches(num_chunks);
+  pool->run(num_chunks, [&](uint chunk) {
+    uint begin = chunk*chunk_size;
+    uint end = min(count, begin + chunk_size);
+    for(uint i=begin; i<end; i++) {
+      if(cancelled != nullptr && (i & 1023) == 0 && cancelled->load(memory_order_relaxed)) {
+        return;
+      }
+      if(matches(i)) {
+        chunk_matches[chunk].push_back(i);
+      }
+    }
+  });
+  out->clear();
+  for(const vector<uint>& matches_in_chunk : chunk_matches) {
+    out->insert(out->end(), matches_in_chunk.begin(), matches_in_chunk.end());
+  }
+  return out->size();
+}
+
+// Same, but over the given candidate indexes rather than [0, count).
+// out must not be candidates.
+template<typename Predicate>
+uint parallel_filter(WorkerPool* pool, const vector<uint>* candidates, Predicate matches, vector<uint>* out,
+                     const atomic<bool>* cancelled = nullptr) {
+  parallel_filter(pool, candidates->size(), [&](uint k) { return matches((*candidates)[k]); }, out, cancelled);
+  for(uint& k : *out) {
+    k = (*candidates)[k];
+  }
+  return out->size();
+}